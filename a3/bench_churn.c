@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "thread.h"
+
+/* Thread create/exit churn: ROUNDS times, create BATCH threads that exit
+ * right away and wait for all of them. Reports the time per thread and the
+ * page faults and heap growth over the run. */
+
+#define ROUNDS  200
+#define BATCH   (THREAD_MAX_THREADS - 1)
+
+static void
+noop(void *arg)
+{
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static Tid tids[BATCH];
+	struct rusage start_ru, end_ru;
+	struct mallinfo start_mi, end_mi;
+	int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+
+	thread_init();
+	getrusage(RUSAGE_SELF, &start_ru);
+	start_mi = mallinfo();
+	double start = now();
+
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < BATCH; i++) {
+			tids[i] = thread_create(noop, NULL);
+			if (!thread_ret_ok(tids[i])) {
+				fprintf(stderr, "thread_create failed: %d\n", tids[i]);
+				exit(1);
+			}
+		}
+		for (int i = 0; i < BATCH; i++) {
+			thread_wait(tids[i], NULL);
+		}
+	}
+
+	double elapsed = now() - start;
+	end_mi = mallinfo();
+	getrusage(RUSAGE_SELF, &end_ru);
+
+	long threads = (long)rounds * BATCH;
+	printf("%ld threads in %.3f s: %.0f ns per create/exit\n",
+	       threads, elapsed, elapsed * 1e9 / threads);
+	printf("page faults: %ld, heap growth: %d bytes\n",
+	       end_ru.ru_minflt - start_ru.ru_minflt,
+	       end_mi.arena - start_mi.arena);
+	return 0;
+}
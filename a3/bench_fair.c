@@ -0,0 +1,86 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* CPU share under oversubscription: NTHREADS threads spin with weights
+ * cycling through weights[], preempted by the timer, for DURATION seconds.
+ * Reports, for each weight, the mean share of the work done and its spread
+ * across threads (mean absolute deviation over the mean). Run with
+ * THREAD_SCHED=fair to use the weights. */
+
+#define NTHREADS  (THREAD_MAX_THREADS - 24)
+#define DURATION  5
+
+static const int weights[] = { 512, 1024, 2048 };
+#define NWEIGHTS (sizeof(weights) / sizeof(weights[0]))
+
+static volatile int stop;
+static volatile unsigned long work[NTHREADS];
+
+static void
+spinner(void *arg)
+{
+	volatile unsigned long *count = arg;
+	while (!stop) {
+		(*count)++;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static Tid tids[NTHREADS];
+	int duration = argc > 1 ? atoi(argv[1]) : DURATION;
+
+	thread_init();
+	for (int i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(spinner, (void *)&work[i]);
+		if (!thread_ret_ok(tids[i])) {
+			fprintf(stderr, "thread_create failed: %d\n", tids[i]);
+			exit(1);
+		}
+		thread_set_weight(tids[i], weights[i % NWEIGHTS]);
+	}
+	register_interrupt_handler(0);
+
+	double end = now() + duration;
+	while (now() < end) {
+	}
+	stop = 1;
+	for (int i = 0; i < NTHREADS; i++) {
+		thread_wait(tids[i], NULL);
+	}
+
+	double total = 0;
+	for (int i = 0; i < NTHREADS; i++) {
+		total += work[i];
+	}
+	printf("%d threads for %d s\n", NTHREADS, duration);
+	printf("%8s %10s %14s %10s\n", "weight", "threads", "mean share", "spread");
+	for (int w = 0; w < NWEIGHTS; w++) {
+		double sum = 0, dev = 0;
+		int n = 0;
+		for (int i = w; i < NTHREADS; i += NWEIGHTS) {
+			sum += work[i] / total;
+			n++;
+		}
+		double mean = sum / n;
+		for (int i = w; i < NTHREADS; i += NWEIGHTS) {
+			dev += fabs(work[i] / total - mean);
+		}
+		printf("%8d %10d %13.4f%% %9.1f%%\n", weights[w], n,
+		       100 * mean, mean > 0 ? 100 * dev / n / mean : 0.0);
+	}
+	return 0;
+}
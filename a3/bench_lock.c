@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* Lock contention: NTHREADS threads, preempted by the timer, each take one
+ * lock ACQUIRES times and work inside and outside it. The lock is held
+ * about half the time, so most acquisitions find it taken and sleep.
+ * Reports the thread switches and time per acquisition. */
+
+#define NTHREADS  512
+#define ACQUIRES  200
+#define WORK      200
+
+static struct lock *lock;
+static volatile unsigned long counter;
+
+static void
+work(void)
+{
+	for (volatile int i = 0; i < WORK; i++) {
+	}
+}
+
+static void
+contender(void *arg)
+{
+	int acquires = *(int *)arg;
+	for (int i = 0; i < acquires; i++) {
+		lock_acquire(lock);
+		counter++;
+		work();
+		lock_release(lock);
+		work();
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static Tid tids[NTHREADS];
+	int acquires = argc > 1 ? atoi(argv[1]) : ACQUIRES;
+
+	thread_init();
+	lock = lock_create();
+	register_interrupt_handler(0);
+
+	double start = now();
+	unsigned long switches = thread_switches();
+	for (int i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(contender, &acquires);
+		if (!thread_ret_ok(tids[i])) {
+			fprintf(stderr, "thread_create failed: %d\n", tids[i]);
+			exit(1);
+		}
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		thread_wait(tids[i], NULL);
+	}
+	switches = thread_switches() - switches;
+	double elapsed = now() - start;
+	lock_destroy(lock);
+
+	unsigned long total = (unsigned long)NTHREADS * acquires;
+	if (counter != total) {
+		fprintf(stderr, "counter is %lu, expected %lu\n", counter, total);
+		exit(1);
+	}
+	unintr_printf("%lu acquisitions by %d threads in %.3f s: "
+		      "%.2f switches and %.0f ns per acquisition\n",
+		      total, NTHREADS, elapsed, (double)switches / total,
+		      elapsed * 1e9 / total);
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* Scaling with workers: a fixed amount of CPU-bound work is split across
+ * NTHREADS threads, preempted by the timer, and run on the number of workers
+ * given as the first argument (default 1). Reports the elapsed time, which
+ * should drop in proportion to the workers, up to the number of CPUs. */
+
+#define NTHREADS  64
+#define WORK      (1UL << 31)
+
+static volatile unsigned long sink[NTHREADS];
+
+static void
+worker(void *arg)
+{
+	volatile unsigned long *out = arg;
+	unsigned long x = 1;
+	for (unsigned long i = 0; i < WORK / NTHREADS; i++) {
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+	}
+	*out = x;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static Tid tids[NTHREADS];
+	int nworkers = argc > 1 ? atoi(argv[1]) : 1;
+
+	if (nworkers < 1 || nworkers > THREAD_MAX_WORKERS) {
+		fprintf(stderr, "usage: %s [workers, 1 to %d]\n", argv[0],
+			THREAD_MAX_WORKERS);
+		exit(1);
+	}
+	thread_init_workers(nworkers);
+	register_interrupt_handler(0);
+
+	double start = now();
+	for (int i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(worker, (void *)&sink[i]);
+		if (!thread_ret_ok(tids[i])) {
+			fprintf(stderr, "thread_create failed: %d\n", tids[i]);
+			exit(1);
+		}
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		thread_wait(tids[i], NULL);
+	}
+	double elapsed = now() - start;
+
+	unintr_printf("%d threads on %d workers: %.3f s\n", NTHREADS, nworkers,
+		      elapsed);
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* Timer ticks: the main thread and NTHREADS-1 others (the first argument)
+ * spin for DURATION seconds (the second), preempted by the timer. Reports
+ * the ticks taken per second, their overruns and jitter, and the spin loop
+ * iterations done per second, which drop with the time lost to ticks. With
+ * a single thread there is nothing to preempt for, so there should be no
+ * ticks at all. */
+
+#define NTHREADS  1
+#define DURATION  2
+
+static volatile int stop;
+static volatile unsigned long work;
+
+static void
+spinner(void *arg)
+{
+	while (!stop) {
+		work++;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads = argc > 1 ? atoi(argv[1]) : NTHREADS;
+	int duration = argc > 2 ? atoi(argv[2]) : DURATION;
+	struct interrupt_stats st;
+
+	thread_init();
+	for (int i = 1; i < nthreads; i++) {
+		Tid tid = thread_create(spinner, NULL);
+		if (!thread_ret_ok(tid)) {
+			fprintf(stderr, "thread_create failed: %d\n", tid);
+			exit(1);
+		}
+	}
+	register_interrupt_handler(0);
+
+	double start = now();
+	double end = start + duration;
+	while (now() < end) {
+		for (int i = 0; i < 4096; i++) {
+			work++;
+		}
+	}
+	double elapsed = now() - start;
+	get_interrupt_stats(&st);
+	stop = 1;
+
+	unintr_printf("%d threads, %d us interval: %.0f ticks/s, %lu overruns, "
+		      "jitter mean %lld ns max %lld ns, %.1f M iterations/s\n",
+		      nthreads, st.interval, st.ticks / elapsed, st.overruns,
+		      st.jitter_mean_ns, st.jitter_max_ns, work / elapsed / 1e6);
+	return 0;
+}
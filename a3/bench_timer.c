@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* Timeouts at scale: NTHREADS threads each sleep ROUNDS times for 1 to
+ * MAX_SLEEP us, so about NTHREADS timeouts are pending at any time.
+ * Reports how late the sleeps ended, and the CPU time used per sleep. */
+
+#define NTHREADS  1000
+#define ROUNDS    20
+#define MAX_SLEEP 50000
+
+static volatile long late_sum, late_max;
+static int rounds;
+
+static long
+now_us(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void
+sleeper(void *arg)
+{
+	unsigned seed = (unsigned long)arg;
+	for (int i = 0; i < rounds; i++) {
+		long usecs = 1 + rand_r(&seed) % MAX_SLEEP;
+		long start = now_us(CLOCK_MONOTONIC);
+		thread_sleep_for(usecs);
+		long late = now_us(CLOCK_MONOTONIC) - start - usecs;
+
+		int enabled = interrupts_off();
+		late_sum += late;
+		if (late > late_max) {
+			late_max = late;
+		}
+		interrupts_set(enabled);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static Tid tids[NTHREADS];
+	rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+
+	thread_init();
+	register_interrupt_handler(0);
+
+	long start = now_us(CLOCK_MONOTONIC);
+	long cpu_start = now_us(CLOCK_PROCESS_CPUTIME_ID);
+	for (long i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(sleeper, (void *)(i + 1));
+		if (!thread_ret_ok(tids[i])) {
+			fprintf(stderr, "thread_create failed: %d\n", tids[i]);
+			exit(1);
+		}
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		thread_wait(tids[i], NULL);
+	}
+	long elapsed = now_us(CLOCK_MONOTONIC) - start;
+	long cpu = now_us(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+	long sleeps = (long)NTHREADS * rounds;
+	unintr_printf("%ld sleeps by %d threads in %.3f s: late by %ld us mean, "
+		      "%ld us max; %.2f us CPU per sleep\n",
+		      sleeps, NTHREADS, elapsed / 1e6, late_sum / sleeps,
+		      late_max, (double)cpu / sleeps);
+	return 0;
+}
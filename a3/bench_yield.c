@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+
+/* Yield ping-pong: the main thread and one other thread yield directly to
+ * each other ROUNDS times. Reports the cost of one thread switch. */
+
+#define ROUNDS  1000000
+
+static int rounds;
+
+static void
+pong(void *arg)
+{
+	Tid main_tid = *(Tid *)arg;
+	for (int i = 0; i < rounds; i++) {
+		thread_yield(main_tid);
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+
+	thread_init();
+	Tid main_tid = thread_id();
+	Tid tid = thread_create(pong, &main_tid);
+	if (!thread_ret_ok(tid)) {
+		fprintf(stderr, "thread_create failed: %d\n", tid);
+		exit(1);
+	}
+
+	double start = now();
+	for (int i = 0; i < rounds; i++) {
+		thread_yield(tid);
+	}
+	double elapsed = now() - start;
+	thread_wait(tid, NULL);
+
+	printf("%d round trips in %.3f s: %.0f ns per switch\n",
+	       rounds, elapsed, elapsed * 1e9 / (2.0 * rounds));
+	return 0;
+}
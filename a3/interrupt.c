@@ -1,7 +1,10 @@
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <ucontext.h>
 #include <unistd.h>
 #include <sys/time.h>
@@ -10,11 +13,82 @@
 #include "interrupt.h"
 
 static void interrupt_handler(int sig, siginfo_t * sip, void *contextVP);
-static void set_interrupt();
 static void set_signal(sigset_t * setp);
 
 static int loud = 0;
 
+/* Interrupts come from POSIX timers on CLOCK_MONOTONIC, one per kernel thread
+ * registered with register_interrupt_thread(), each signalling its own
+ * thread only. If none is registered, register_interrupt_handler()
+ * registers its caller. The timers are periodic, so the handler makes no
+ * system call to re-arm them.
+ *
+ * A timer is stopped by interrupts_tick_stop() when its thread has nothing
+ * else to run, and restarted by interrupts_tick_resume() when a thread is
+ * made ready, so a process with a single runnable thread takes no
+ * interrupts at all. */
+#define MAX_INTERRUPT_THREADS 64
+
+struct interrupt_thread {
+	pid_t tid;
+	timer_t timer;
+	int stopped;		/* disarmed by interrupts_tick_stop() */
+	/* statistics, see get_interrupt_stats() */
+	unsigned long ticks;
+	unsigned long overruns;
+	unsigned long jitter_samples;
+	long long jitter_sum_ns;
+	long long jitter_max_ns;
+	long long last_ns;	/* time of the last tick, 0 after arming */
+};
+
+/* ithreads_lock is only taken with interrupts disabled, as the handler may
+ * take it */
+static struct interrupt_thread ithreads[MAX_INTERRUPT_THREADS];
+static int nithreads;
+static int nstopped;
+static int started;		/* handler registered */
+static int interval = SIG_INTERVAL;	/* in microseconds */
+static __thread struct interrupt_thread *self_ithread;
+static pthread_mutex_t ithreads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Arms the timer of it to fire every usecs, or disarms it if usecs is 0 */
+static void
+arm_timer(struct interrupt_thread *it, int usecs)
+{
+	struct itimerspec its;
+	int ret;
+
+	its.it_value.tv_sec = usecs / 1000000;
+	its.it_value.tv_nsec = usecs % 1000000 * 1000;
+	its.it_interval = its.it_value;
+	it->last_ns = 0;
+	ret = timer_settime(it->timer, 0, &its, NULL);
+	assert(!ret);
+}
+
+static void
+start_thread_timer(struct interrupt_thread *it)
+{
+	struct sigevent sev = { 0 };
+	int ret;
+
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIG_TYPE;
+	sev._sigev_un._tid = it->tid;
+	ret = timer_create(CLOCK_MONOTONIC, &sev, &it->timer);
+	assert(!ret);
+	arm_timer(it, interval);
+}
+
 /* Should be called when you initialize threads package. Many of the calls won't
  * make sense at first -- study the man pages! */
 void
@@ -23,10 +97,19 @@ register_interrupt_handler(int verbose)
 	struct sigaction action;
 	int error;
 	static int init = 0;
+	const char *interval_env = getenv("INTERRUPT_INTERVAL");
 
 	assert(!init);	/* should only register once */
 	init = 1;
 	loud = verbose;
+	if (interval_env != NULL) {
+		interval = atoi(interval_env);
+		if (interval <= 0) {
+			fprintf(stderr, "INTERRUPT_INTERVAL: must be a positive "
+				"number of microseconds\n");
+			exit(1);
+		}
+	}
 	action.sa_handler = NULL;
 	action.sa_sigaction = interrupt_handler;
 	/* block SIG_TYPE while interrupt_handler() is running. This will avoid
@@ -41,7 +124,148 @@ register_interrupt_handler(int verbose)
 		perror("Setting up signal handler");
 		assert(0);
 	}
-	set_interrupt();
+
+	if (nithreads == 0) {
+		register_interrupt_thread();
+	}
+	int enabled = interrupts_off();
+	pthread_mutex_lock(&ithreads_lock);
+	started = 1;
+	for (int i = 0; i < nithreads; i++) {
+		start_thread_timer(&ithreads[i]);
+	}
+	pthread_mutex_unlock(&ithreads_lock);
+	interrupts_set(enabled);
+}
+
+/* Should be called by each kernel thread that runs user threads, when there
+ * are several, before or after register_interrupt_handler(). Each then gets
+ * interrupts every interval, whatever the others are doing. */
+void
+register_interrupt_thread(void)
+{
+	int enabled = interrupts_off();
+
+	pthread_mutex_lock(&ithreads_lock);
+	assert(nithreads < MAX_INTERRUPT_THREADS);
+	self_ithread = &ithreads[nithreads];
+	self_ithread->tid = gettid();
+	if (started) {
+		start_thread_timer(self_ithread);
+	}
+	nithreads++;
+	pthread_mutex_unlock(&ithreads_lock);
+	interrupts_set(enabled);
+}
+
+/* Sets the interval between interrupts on each thread to usecs, from
+ * SIG_INTERVAL or the INTERRUPT_INTERVAL environment variable */
+void
+set_interrupt_interval(int usecs)
+{
+	assert(usecs > 0);
+	int enabled = interrupts_off();
+	pthread_mutex_lock(&ithreads_lock);
+	interval = usecs;
+	for (int i = 0; started && i < nithreads; i++) {
+		if (!ithreads[i].stopped) {
+			arm_timer(&ithreads[i], interval);
+		}
+	}
+	pthread_mutex_unlock(&ithreads_lock);
+	interrupts_set(enabled);
+}
+
+/* Stops interrupts on the calling kernel thread, with interrupts disabled.
+ * Called by the scheduler when there is no other thread to run. Ticks keep
+ * coming while the handler is verbose, so that its output shows them. */
+void
+interrupts_tick_stop(void)
+{
+	struct interrupt_thread *it = self_ithread;
+
+	if (loud || it == NULL || it->stopped) {
+		return;
+	}
+	pthread_mutex_lock(&ithreads_lock);
+	it->stopped = 1;
+	__atomic_add_fetch(&nstopped, 1, __ATOMIC_SEQ_CST);
+	arm_timer(it, 0);
+	pthread_mutex_unlock(&ithreads_lock);
+}
+
+/* Restarts interrupts on every stopped thread, with interrupts disabled.
+ * Called by the scheduler when a thread is made ready. Cheap when none is
+ * stopped. */
+void
+interrupts_tick_resume(void)
+{
+	if (__atomic_load_n(&nstopped, __ATOMIC_SEQ_CST) == 0) {
+		return;
+	}
+	pthread_mutex_lock(&ithreads_lock);
+	for (int i = 0; i < nithreads; i++) {
+		if (ithreads[i].stopped) {
+			ithreads[i].stopped = 0;
+			__atomic_sub_fetch(&nstopped, 1, __ATOMIC_SEQ_CST);
+			arm_timer(&ithreads[i], interval);
+		}
+	}
+	pthread_mutex_unlock(&ithreads_lock);
+}
+
+/* Sums the tick statistics of all threads into st. Jitter is how far the
+ * time between two ticks was from the interval. */
+void
+get_interrupt_stats(struct interrupt_stats *st)
+{
+	int enabled = interrupts_off();
+	pthread_mutex_lock(&ithreads_lock);
+	memset(st, 0, sizeof(*st));
+	long long jitter_sum_ns = 0;
+	for (int i = 0; i < nithreads; i++) {
+		const struct interrupt_thread *it = &ithreads[i];
+		st->ticks += it->ticks;
+		st->overruns += it->overruns;
+		st->stopped += it->stopped;
+		jitter_sum_ns += it->jitter_sum_ns;
+		st->jitter_samples += it->jitter_samples;
+		if (it->jitter_max_ns > st->jitter_max_ns) {
+			st->jitter_max_ns = it->jitter_max_ns;
+		}
+	}
+	if (st->jitter_samples > 0) {
+		st->jitter_mean_ns = jitter_sum_ns / (long long)st->jitter_samples;
+	}
+	st->interval = interval;
+	pthread_mutex_unlock(&ithreads_lock);
+	interrupts_set(enabled);
+}
+
+/* Counts a tick of it, which fired now */
+static void
+record_tick(struct interrupt_thread *it)
+{
+	long long now = now_ns();
+	int overrun = timer_getoverrun(it->timer);
+
+	it->ticks++;
+	if (overrun > 0) {
+		it->overruns += overrun;
+	}
+	if (it->last_ns != 0) {
+		/* overrun ticks were missed, not late */
+		long long jitter = now - it->last_ns - (overrun + 1) * interval * 1000LL;
+		if (jitter < 0) {
+			jitter = -jitter;
+		}
+		it->jitter_sum_ns += jitter;
+		it->jitter_samples++;
+		if (jitter > it->jitter_max_ns) {
+			it->jitter_max_ns = jitter;
+		}
+	}
+	it->last_ns = now;
 }
 
 /* enables interrupts. */
@@ -169,27 +393,10 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 		       __FUNCTION__, context,
 		       diff.tv_sec * 1000000 + diff.tv_usec);
 	}
-	set_interrupt();
-	/* implement preemptive threading by calling thread_yield */
-	thread_yield(THREAD_ANY);
-}
-
-/*
- * Use the setitimer() system call to set an alarm in the future. At that time,
- * this process will receive a SIGALRM signal.
- */
-static void
-set_interrupt()
-{
-	int ret;
-	struct itimerval val;
-
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = 0;
-
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = SIG_INTERVAL;
-
-	ret = setitimer(ITIMER_REAL, &val, NULL);
-	assert(!ret);
+	if (self_ithread != NULL) {
+		record_tick(self_ithread);
+	}
+	/* implement preemptive threading by letting the scheduler preempt the
+	 * running thread */
+	thread_tick();
 }
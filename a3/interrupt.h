@@ -12,10 +12,32 @@
 
 /* we will use this signal type for delivering "interrupts". */
 #define SIG_TYPE SIGALRM
-/* the interrupt will be delivered every 200 usec */
+/* the interrupt will be delivered every 200 usec, unless changed with
+ * set_interrupt_interval() or the INTERRUPT_INTERVAL environment variable */
 #define SIG_INTERVAL 200
 
 void register_interrupt_handler(int verbose);
+/* give the calling kernel thread a timer interrupt of its own */
+void register_interrupt_thread(void);
+/* change the interval between interrupts, in usec */
+void set_interrupt_interval(int usecs);
+/* stop interrupts on the calling kernel thread while it has nothing else to
+ * run, and restart them on all threads when there is; called by the
+ * scheduler with interrupts disabled */
+void interrupts_tick_stop(void);
+void interrupts_tick_resume(void);
+
+/* timer interrupt statistics, summed over all kernel threads */
+struct interrupt_stats {
+	unsigned long ticks;		/* interrupts handled */
+	unsigned long overruns;		/* expirations missed while blocked */
+	unsigned long stopped;		/* threads with interrupts stopped now */
+	unsigned long jitter_samples;
+	long long jitter_mean_ns;	/* distance between ticks and the */
+	long long jitter_max_ns;	/* interval, mean and max */
+	int interval;			/* usec */
+};
+void get_interrupt_stats(struct interrupt_stats *st);
 int interrupts_on(void);
 int interrupts_off(void);
 int interrupts_set(int enabled);
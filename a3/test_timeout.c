@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include "thread.h"
+#include "interrupt.h"
+
+/* Timed sleeps and waits: each must time out no earlier than asked, and a
+ * wait that is satisfied in time must not time out. */
+
+#define NSLEEPERS 500
+
+static struct lock *testlock;
+static struct cv *testcv;
+static int child_ret1, child_ret2;
+static volatile int main_woke, child_woke;
+
+static long
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void
+sleep_then_exit(void *arg)
+{
+	thread_sleep_for(30000);
+	thread_exit(7);
+}
+
+static void
+lock_waiter(void *arg)
+{
+	child_ret1 = lock_acquire_timeout(testlock, 10000);
+	child_ret2 = lock_acquire_timeout(testlock, 1000000);
+	lock_release(testlock);
+}
+
+static void
+lock_holder(void *arg)
+{
+	lock_acquire(testlock);
+	lock_release(testlock);
+}
+
+static void
+cv_signaller(void *arg)
+{
+	lock_acquire(testlock);
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+}
+
+static void
+sleep_then_spin(void *arg)
+{
+	thread_sleep_for(200000);
+	child_woke = 1;
+	while (!main_woke) {
+	}
+}
+
+static void
+sleeper(void *arg)
+{
+	long usecs = (long)arg;
+	long start = now_us();
+	thread_sleep_for(usecs);
+	assert(now_us() - start >= usecs);
+}
+
+int
+main(int argc, char **argv)
+{
+	long start;
+	int code;
+	Tid tid;
+
+	thread_init();
+
+	/* alone, and before any timer interrupt is registered */
+	start = now_us();
+	assert(thread_sleep_for(20000) == 0);
+	assert(now_us() - start >= 20000);
+	assert(thread_sleep_for(-1) == THREAD_INVALID);
+	unintr_printf("sleep alone ok\n");
+
+	register_interrupt_handler(0);
+
+	tid = thread_create(sleep_then_exit, NULL);
+	assert(thread_ret_ok(tid));
+	start = now_us();
+	assert(thread_wait_timeout(tid, &code, 5000) == THREAD_TIMEOUT);
+	assert(now_us() - start >= 5000);
+	assert(thread_wait_timeout(tid, &code, 1000000) == tid);
+	assert(code == 7);
+	unintr_printf("thread_wait_timeout ok\n");
+
+	testlock = lock_create();
+	testcv = cv_create();
+	lock_acquire(testlock);
+	tid = thread_create(lock_waiter, NULL);
+	assert(thread_ret_ok(tid));
+	thread_sleep_for(30000);
+	lock_release(testlock);
+	thread_wait(tid, NULL);
+	assert(child_ret1 == THREAD_TIMEOUT);
+	assert(child_ret2 == 0);
+	assert(lock_acquire_timeout(testlock, 0) == 0);
+	unintr_printf("lock_acquire_timeout ok\n");
+
+	/* a waiter killed after the lock is handed to it passes it on */
+	tid = thread_create(lock_holder, NULL);
+	assert(thread_ret_ok(tid));
+	thread_sleep_for(10000);
+	lock_release(testlock);
+	assert(thread_kill(tid) == tid);
+	thread_yield(tid);
+	assert(lock_acquire_timeout(testlock, 1000000) == 0);
+	unintr_printf("lock handoff to a killed waiter ok\n");
+
+	start = now_us();
+	assert(cv_wait_timeout(testcv, testlock, 10000) == THREAD_TIMEOUT);
+	assert(now_us() - start >= 10000);
+	tid = thread_create(cv_signaller, NULL);
+	assert(thread_ret_ok(tid));
+	assert(cv_wait_timeout(testcv, testlock, 1000000) == 0);
+	lock_release(testlock);
+	thread_wait(tid, NULL);
+	assert(cv_wait_timeout(testcv, testlock, 1000) == THREAD_INVALID);
+	cv_destroy(testcv);
+	lock_destroy(testlock);
+	unintr_printf("cv_wait_timeout ok\n");
+
+	static Tid sleepers[NSLEEPERS];
+	for (long i = 0; i < NSLEEPERS; i++) {
+		/* 1 to 100 ms, spread over the first two wheel levels */
+		sleepers[i] = thread_create(sleeper, (void *)(1000 + i * 7919 % 99000));
+		assert(thread_ret_ok(sleepers[i]));
+	}
+	for (int i = 0; i < NSLEEPERS; i++) {
+		thread_wait(sleepers[i], NULL);
+	}
+	unintr_printf("%d sleepers ok\n", NSLEEPERS);
+
+	/* under THREAD_SCHED=fair, the time slept while every thread is
+	 * blocked must not be charged to the thread that runs next, or it
+	 * would wait out the sleep again while the other runs */
+	tid = thread_create(sleep_then_spin, NULL);
+	assert(thread_ret_ok(tid));
+	thread_yield(tid);
+	start = now_us();
+	thread_sleep_for(200000);
+	main_woke = 1;
+	while (!child_woke) {
+	}
+	assert(now_us() - start < 300000);
+	thread_wait(tid, NULL);
+	unintr_printf("sleep while all blocked ok\n");
+
+	unintr_printf("timeout test done\n");
+	return 0;
+}
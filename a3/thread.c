@@ -1,157 +1,1121 @@
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <ucontext.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "thread.h"
 #include "interrupt.h"
 
-/* This is the ready queue structure and corresponding funcitons */
-typedef struct queue_node{
-    struct queue_node * next;
-    Tid tid;
+enum state_t{READY, RUNNING, NOTVALID, BLOCK};
+
+/* A thread stack mapping, including the guard page at its bottom */
+struct stack {
+    void * base;
+    size_t size;
+};
+
+/* This is the thread control block */
+struct thread {
+    /* ... Fill this in ... */
+    enum state_t state;
+    void * sp;             /* saved stack pointer while not running */
+    int on_cpu;            /* running, or not yet saved by the last switch */
+    /* MLFQ level, ticks used at that level, and boost epoch of the level */
+    int level;
+    unsigned ticks;
+    unsigned epoch;
+    /* CFS weight, weighted run time in ns, and index in the CFS heap (-1
+     * when not in it) */
+    int weight;
+    uint64_t vruntime;
+    int heap_index;
+    /* timeout on the timer wheel: links in its slot, the slot (-1 if not
+     * armed), the wheel time it expires at, and whether it has fired */
+    Tid t_next;
+    Tid t_prev;
+    int t_slot;
+    uint64_t t_expires;
+    int timed_out;
+    int be_killed;
+    /* lock handed off to the thread by lock_release() that it has not yet
+     * returned from acquiring, or NULL */
+    struct lock * handoff;
+    int exit_code;
+    struct wait_queue * wait_queue;
+    struct stack stack;
+    /* links on the queue the thread is on, and that queue (NULL if none) */
+    Tid q_next;
+    Tid q_prev;
+    struct wait_queue * queue;
+};
+
+struct thread threads[THREAD_MAX_THREADS];
+
+/* Kernel threads that run the user threads. After thread_init() there is
+ * one, the process's main thread. After thread_init_workers() there are
+ * several, each with its own deque of ready threads (see the work-stealing
+ * policy below), its own timer interrupt, and an idle context that runs
+ * while it has no user thread. A user thread may move to another worker
+ * whenever it is switched out. */
+#define DEQUE_SIZE (2 * THREAD_MAX_THREADS)
+
+struct deque {
+    long top;               /* next entry to take, by the owner or a thief */
+    long bottom;            /* next free slot; only the owner pushes */
+    Tid buf[DEQUE_SIZE];
+};
+
+struct worker {
+    Tid current;            /* user thread running, THREAD_NONE when idle */
+    Tid prev;               /* thread just switched out, see finish_switch */
+    Tid pending;            /* thread for the idle context to switch to */
+    int lock_depth;         /* nesting of sched_lock() */
+    void * idle_sp;         /* saved stack pointer of the idle context */
+    pthread_t pthread;
+    struct deque deque;
+    Tid scratch[DEQUE_SIZE];
+    unsigned long switches; /* switches to a user thread, see thread_switches */
+} __attribute__((aligned(64)));
+
+struct worker workers[THREAD_MAX_WORKERS];
+int nworkers = 1;
+
+static __thread struct worker * self_worker = &workers[0];
+
+/* The worker running the caller. It must be looked up again after every
+ * switch, as the thread may have moved to another worker since; noipa keeps
+ * the compiler from reusing a result across one. */
+static __attribute__((noinline, noipa)) struct worker * worker_self(void){
+    return self_worker;
+}
+
+#define current_tid (worker_self()->current)
+
+/* Shared state (wait queues, locks, the exit queue, tids and stacks) is
+ * protected by disabling interrupts and, when there are several workers, a
+ * global spinlock. sched_lock() nests, and returns whether interrupts were
+ * enabled, like interrupts_set(0). A thread that switches out while holding
+ * it drops it for the switch and takes it again when it runs. */
+int big_lock;
+
+static void spin_pause(int * spins){
+    if (++*spins < 64){
+        __builtin_ia32_pause();
+    }
+    else{
+        sched_yield();
+    }
+}
+
+static void big_lock_acquire(void){
+    int spins = 0;
+    while (__atomic_exchange_n(&big_lock, 1, __ATOMIC_ACQUIRE)){
+        while (__atomic_load_n(&big_lock, __ATOMIC_RELAXED)){
+            spin_pause(&spins);
+        }
+    }
+}
+
+static void big_lock_release(void){
+    __atomic_store_n(&big_lock, 0, __ATOMIC_RELEASE);
+}
+
+static int sched_lock(void){
+    int enabled = interrupts_set(0);
+    if (worker_self()->lock_depth++ == 0 && nworkers > 1){
+        big_lock_acquire();
+    }
+    return enabled;
+}
+
+static void sched_unlock(int enabled){
+    if (--worker_self()->lock_depth == 0 && nworkers > 1){
+        big_lock_release();
+    }
+    interrupts_set(enabled);
+}
+
+/* Drops the lock entirely before a switch, returning the depth to retake */
+static int sched_lock_drop(void){
+    struct worker * w = worker_self();
+    int depth = w->lock_depth;
+    if (depth > 0){
+        w->lock_depth = 0;
+        if (nworkers > 1){
+            big_lock_release();
+        }
+    }
+    return depth;
+}
 
-} queue_node_t;
+static void sched_lock_retake(int depth){
+    if (depth > 0){
+        if (nworkers > 1){
+            big_lock_acquire();
+        }
+        worker_self()->lock_depth = depth;
+    }
+}
 
-/* This is the wait queue structure */
+/* The ready queue, the exit queue and the wait queues are doubly linked lists
+ * threaded through the thread control blocks, with THREAD_NONE ending the
+ * list. A thread is on at most one queue at a time, so enqueue, dequeue and
+ * removal of a given thread are O(1) and never allocate, which keeps malloc
+ * out of the preemption path. The queue functions must be called with
+ * sched_lock() held. */
 typedef struct wait_queue {
     /* ... Fill this in Assignment 3 ... */
-    queue_node_t * root;
-    queue_node_t * tail;
+    Tid head;
+    Tid tail;
 }queue_t;
 
 queue_t* queue_initialize(){
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     queue_t * queue = malloc(sizeof(queue_t));
-    queue->root = NULL;
-    queue->tail = NULL;
-    interrupts_set(enabled);
+    queue->head = THREAD_NONE;
+    queue->tail = THREAD_NONE;
+    sched_unlock(enabled);
     return queue;
 }
 
 void queue_enq(queue_t * q, Tid tid){
-    int enabled = interrupts_set(0);
-    queue_node_t * node = malloc(sizeof(queue_node_t));
-    node->tid = tid;
-    node->next = NULL;
+    struct thread * t = &threads[tid];
+    assert(t->queue == NULL);
+
+    t->queue = q;
+    t->q_next = THREAD_NONE;
+    t->q_prev = q->tail;
+    if (q->tail == THREAD_NONE){
+        q->head = tid;
+    }
+    else{
+        threads[q->tail].q_next = tid;
+    }
+    q->tail = tid;
+}
+
+static void queue_remove(queue_t * q, Tid tid){
+    struct thread * t = &threads[tid];
 
-    if (q->root == NULL){
-        q->root = q->tail = node;
+    if (t->q_prev == THREAD_NONE){
+        q->head = t->q_next;
     }
     else{
-        q->tail->next = node;
-        q->tail = node;
+        threads[t->q_prev].q_next = t->q_next;
     }
-    interrupts_set(enabled);
+    if (t->q_next == THREAD_NONE){
+        q->tail = t->q_prev;
+    }
+    else{
+        threads[t->q_next].q_prev = t->q_prev;
+    }
+    t->queue = NULL;
 }
 
 Tid queue_deq(queue_t * q){
-    int enabled = interrupts_set(0);
-    if (q->root == NULL){
-        interrupts_set(enabled);
+    Tid tid = q->head;
+    if (tid == THREAD_NONE){
         return THREAD_NONE;
     }
+    queue_remove(q, tid);
+    return tid;
+}
+
+/* Removes tid from q. Returns tid, or THREAD_INVALID if it is not on q. */
+Tid queue_exact(queue_t * q, Tid tid){
+    if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid].queue != q){
+        return THREAD_INVALID;
+    }
+    queue_remove(q, tid);
+    return tid;
+}
+/* End of ready queue implementation*/
+
+
+/* Thread stacks are mapped with mmap, with a PROT_NONE guard page below the
+ * stack so that an overflow faults instead of overwriting another thread's
+ * memory. Pages are committed only when first touched, so a mostly idle
+ * thread costs a page or two rather than its whole stack. The stacks of
+ * exited threads are pooled and handed to new threads asking for the same
+ * size, so create/exit churn does not map and unmap memory. */
+#define STACK_POOL_MAX THREAD_MAX_THREADS
+
+struct stack stack_pool[STACK_POOL_MAX];
+int stack_pool_len;
+size_t page_size;
+
+/* Gets a stack mapping of size bytes from the pool, or maps a new one.
+ * Returns 0 on success and -1 if there is no memory. */
+static int stack_get(size_t size, struct stack * s){
+    for (int i = stack_pool_len - 1; i >= 0; i--){
+        if (stack_pool[i].size == size){
+            *s = stack_pool[i];
+            stack_pool[i] = stack_pool[--stack_pool_len];
+            return 0;
+        }
+    }
+
+    void * base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED){
+        return -1;
+    }
+    if (mprotect(base, page_size, PROT_NONE) != 0){
+        munmap(base, size);
+        return -1;
+    }
+    s->base = base;
+    s->size = size;
+    return 0;
+}
+
+static void stack_put(struct stack * s){
+    if (s->base == NULL){
+        return;
+    }
+    if (stack_pool_len < STACK_POOL_MAX){
+        stack_pool[stack_pool_len++] = *s;
+    }
     else{
-        queue_node_t * node = q->root;
-        Tid tid = node->tid;
-        q->root = q->root->next;
-        free(node);
+        munmap(s->base, s->size);
+    }
+    s->base = NULL;
+}
 
-        if (q->root == NULL){
-            q->tail = NULL;
+volatile unsigned num_thr;
+queue_t * ready_queue;
+queue_t * exit_queue;
+Tid recent_tid;
+
+/* Free tids: bit i of tid_free[w] is set when tid 64 * w + i is NOTVALID,
+ * and bit w of tid_free_summary when tid_free[w] has any bit set, so a free
+ * tid is found with two count-trailing-zeros whatever the number of live
+ * threads. */
+#define TID_WORDS (THREAD_MAX_THREADS / 64)
+_Static_assert(THREAD_MAX_THREADS % 64 == 0 && TID_WORDS <= 64,
+               "free-tid bitmap needs THREAD_MAX_THREADS a multiple of 64, at most 4096");
+
+uint64_t tid_free[TID_WORDS];
+uint64_t tid_free_summary;
+
+static void tid_release(Tid tid){
+    tid_free[tid / 64] |= 1ULL << (tid % 64);
+    tid_free_summary |= 1ULL << (tid / 64);
+}
+
+static void tid_take(Tid tid){
+    tid_free[tid / 64] &= ~(1ULL << (tid % 64));
+    if (tid_free[tid / 64] == 0){
+        tid_free_summary &= ~(1ULL << (tid / 64));
+    }
+}
+
+/* Returns the first free tid at or after start, wrapping around to 0, or
+ * THREAD_NOMORE if there is none. */
+static Tid tid_find(Tid start){
+    if (start >= THREAD_MAX_THREADS){
+        start = 0;
+    }
+    int w = start / 64;
+    uint64_t bits = tid_free[w] & (~0ULL << (start % 64));
+    if (bits){
+        return w * 64 + __builtin_ctzll(bits);
+    }
+    uint64_t words = tid_free_summary & ~((2ULL << w) - 1);   /* words above w */
+    if (words == 0){
+        words = tid_free_summary;
+        if (words == 0){
+            return THREAD_NOMORE;
         }
-        interrupts_set(enabled);
-        return tid;
     }
+    w = __builtin_ctzll(words);
+    return w * 64 + __builtin_ctzll(tid_free[w]);
 }
 
-Tid queue_exact(queue_t * q, Tid tid){
-    int enabled = interrupts_set(0);
-    if (q->root == NULL){
-        interrupts_set(enabled);
+void free_exit_threads(queue_t * q);
+
+//-----------------------------------------------------------------------
+// Scheduling policies. A policy keeps the set of ready threads and picks
+// the next one to run; thread_yield(THREAD_ANY), thread_sleep and
+// thread_exit run whatever next() returns. The policy is chosen in
+// thread_init_sched() and cannot change afterwards.
+
+struct sched_policy {
+    const char * name;
+    void (*init)(void);         /* set up an empty ready set */
+    void (*ready)(Tid tid);     /* add tid to the ready set */
+    Tid (*next)(void);          /* remove and return the next thread to run,
+                                 * or THREAD_NONE if none is ready */
+    Tid (*remove)(Tid tid);     /* remove tid from the ready set, or return
+                                 * THREAD_INVALID if it is not in it */
+
+    /* Optional hooks, NULL if the policy does not provide them */
+    void (*create)(Tid tid);    /* a new thread, before it is first ready */
+    void (*stop)(Tid tid);      /* the running thread tid is about to be
+                                 * switched out (before ready(tid) if it
+                                 * stays ready) */
+    int (*tick)(void);          /* timer tick; returns whether to preempt the
+                                 * running thread (always, if NULL) */
+    int (*empty)(void);         /* whether no thread is ready; needed with
+                                 * tick, to stop ticks when it does not
+                                 * preempt */
+    void (*idle)(void);         /* the process has idled with no thread
+                                 * running, and the next one is about to
+                                 * run */
+};
+
+const struct sched_policy * sched;
+
+//-----------------------------------------------------------------------
+// FIFO: a single ready queue, and every tick preempts the running thread.
+
+static void fifo_init(void){
+    ready_queue = queue_initialize();
+}
+
+static void fifo_ready(Tid tid){
+    queue_enq(ready_queue, tid);
+}
+
+static Tid fifo_next(void){
+    return queue_deq(ready_queue);
+}
+
+static Tid fifo_remove(Tid tid){
+    return queue_exact(ready_queue, tid);
+}
+
+//-----------------------------------------------------------------------
+// MLFQ: a ready queue per level, level 0 first. A thread runs for
+// mlfq_quantum(level) ticks at a level, counted across yields and sleeps so
+// that yielding just before the tick does not keep it at the top, and then
+// moves down a level. A thread at a level is preempted by a tick only when
+// its quantum is used up or a thread is ready at a higher level. Every
+// MLFQ_BOOST_TICKS ticks all threads go back to level 0, so CPU-bound
+// threads at the bottom are not starved; sleeping threads are moved lazily,
+// when they are next made ready, by comparing their epoch with the boost
+// epoch. Bit l of mlfq_bitmap is set when level l has ready threads.
+
+#define MLFQ_LEVELS 4
+#define MLFQ_BOOST_TICKS 250    /* 50 ms at one tick every SIG_INTERVAL us */
+
+static queue_t mlfq_queues[MLFQ_LEVELS];
+static unsigned mlfq_bitmap;
+static unsigned mlfq_epoch;
+static unsigned mlfq_ticks;
+
+static unsigned mlfq_quantum(int level){
+    return 1U << level;
+}
+
+static void mlfq_init(void){
+    for (int l = 0; l < MLFQ_LEVELS; l++){
+        mlfq_queues[l].head = mlfq_queues[l].tail = THREAD_NONE;
+    }
+    mlfq_bitmap = 0;
+    mlfq_epoch = 0;
+    mlfq_ticks = 0;
+    threads[current_tid].level = 0;
+    threads[current_tid].ticks = 0;
+    threads[current_tid].epoch = 0;
+}
+
+static void mlfq_create(Tid tid){
+    threads[tid].level = 0;
+    threads[tid].ticks = 0;
+    threads[tid].epoch = mlfq_epoch;
+}
+
+static void mlfq_ready(Tid tid){
+    struct thread * t = &threads[tid];
+    if (t->epoch != mlfq_epoch){
+        t->level = 0;
+        t->ticks = 0;
+        t->epoch = mlfq_epoch;
+    }
+    queue_enq(&mlfq_queues[t->level], tid);
+    mlfq_bitmap |= 1U << t->level;
+}
+
+static Tid mlfq_take(int level, Tid tid){
+    if (mlfq_queues[level].head == THREAD_NONE){
+        mlfq_bitmap &= ~(1U << level);
+    }
+    return tid;
+}
+
+static Tid mlfq_next(void){
+    if (mlfq_bitmap == 0){
+        return THREAD_NONE;
+    }
+    int level = __builtin_ctz(mlfq_bitmap);
+    return mlfq_take(level, queue_deq(&mlfq_queues[level]));
+}
+
+static Tid mlfq_remove(Tid tid){
+    queue_t * q = threads[tid].queue;
+    if (q < &mlfq_queues[0] || q >= &mlfq_queues[MLFQ_LEVELS]){
         return THREAD_INVALID;
     }
-    else{
-        queue_node_t * node = q->root;
+    return mlfq_take(q - mlfq_queues, queue_exact(q, tid));
+}
 
-        if (node->tid == tid){
-            q->root = node->next;
-            free(node);
+static void mlfq_boost(void){
+    mlfq_epoch += 1;
+    for (int l = 1; l < MLFQ_LEVELS; l++){
+        Tid tid;
+        while ((tid = queue_deq(&mlfq_queues[l])) != THREAD_NONE){
+            queue_enq(&mlfq_queues[0], tid);
+        }
+    }
+    for (Tid tid = mlfq_queues[0].head; tid != THREAD_NONE; tid = threads[tid].q_next){
+        threads[tid].level = 0;
+        threads[tid].ticks = 0;
+        threads[tid].epoch = mlfq_epoch;
+    }
+    mlfq_bitmap = mlfq_queues[0].head != THREAD_NONE ? 1U : 0;
+}
 
-            if (q->root == NULL){
-                q->tail = NULL;
-            }
-            interrupts_set(enabled);
-            return tid;
+static int mlfq_tick(void){
+    struct thread * t = &threads[current_tid];
+
+    if (++mlfq_ticks % MLFQ_BOOST_TICKS == 0){
+        mlfq_boost();
+        t->level = 0;
+        t->ticks = 0;
+        t->epoch = mlfq_epoch;
+        return 1;
+    }
+    if (++t->ticks >= mlfq_quantum(t->level)){
+        if (t->level < MLFQ_LEVELS - 1){
+            t->level += 1;
         }
-        queue_node_t * pre_node = q->root;
-        node = q->root->next;
+        t->ticks = 0;
+        return 1;
+    }
+    /* a thread is ready at a higher level */
+    return (mlfq_bitmap & ((1U << t->level) - 1)) != 0;
+}
+
+static int mlfq_empty(void){
+    return mlfq_bitmap == 0;
+}
+
+//-----------------------------------------------------------------------
+// Fair share (CFS): each thread accumulates virtual run time, the time it
+// ran as measured with CLOCK_MONOTONIC at each switch and tick, scaled by
+// THREAD_WEIGHT_DEFAULT / weight. The ready threads are kept in a min-heap
+// on vruntime and the lowest runs next, so over time every thread gets CPU
+// in proportion to its weight. A tick preempts the running thread once its
+// vruntime is CFS_GRANULARITY_NS past the lowest ready one.
+//
+// cfs_min_vruntime follows the lowest vruntime of the running and ready
+// threads and never goes back. New threads start there, and a woken thread
+// is moved up to at most CFS_SLEEP_CREDIT_NS below it, so that sleeping
+// does not bank CPU time to be claimed all at once later.
+
+#define CFS_GRANULARITY_NS 100000
+#define CFS_SLEEP_CREDIT_NS 1000000
+
+static Tid cfs_heap[THREAD_MAX_THREADS];
+static int cfs_len;
+static uint64_t cfs_min_vruntime;
+static uint64_t cfs_start;          /* when the running thread was last charged */
+
+static uint64_t cfs_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* vruntime of a is before that of b */
+static int cfs_before(Tid a, Tid b){
+    return (int64_t)(threads[a].vruntime - threads[b].vruntime) < 0;
+}
+
+static void cfs_place(int i, Tid tid){
+    cfs_heap[i] = tid;
+    threads[tid].heap_index = i;
+}
 
-        while (node != NULL && node->tid != tid){
-            pre_node = node;
-            node = node->next;
+static void cfs_sift_up(int i){
+    Tid tid = cfs_heap[i];
+    while (i > 0 && cfs_before(tid, cfs_heap[(i - 1) / 2])){
+        cfs_place(i, cfs_heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    cfs_place(i, tid);
+}
+
+static void cfs_sift_down(int i){
+    Tid tid = cfs_heap[i];
+    for (;;){
+        int child = 2 * i + 1;
+        if (child >= cfs_len){
+            break;
+        }
+        if (child + 1 < cfs_len && cfs_before(cfs_heap[child + 1], cfs_heap[child])){
+            child += 1;
         }
+        if (!cfs_before(cfs_heap[child], tid)){
+            break;
+        }
+        cfs_place(i, cfs_heap[child]);
+        i = child;
+    }
+    cfs_place(i, tid);
+}
 
-        if (node == NULL){
-            interrupts_set(enabled);
-            return THREAD_INVALID;
+/* Charges the running thread for the time since it was last charged */
+static void cfs_charge(void){
+    uint64_t now = cfs_now();
+    struct thread * t = &threads[current_tid];
+
+    t->vruntime += (now - cfs_start) * THREAD_WEIGHT_DEFAULT / t->weight;
+    cfs_start = now;
+
+    uint64_t min = t->vruntime;
+    if (cfs_len > 0 && cfs_before(cfs_heap[0], current_tid)){
+        min = threads[cfs_heap[0]].vruntime;
+    }
+    if ((int64_t)(min - cfs_min_vruntime) > 0){
+        cfs_min_vruntime = min;
+    }
+}
+
+static void cfs_init(void){
+    cfs_len = 0;
+    cfs_min_vruntime = 0;
+    cfs_start = cfs_now();
+    threads[current_tid].vruntime = 0;
+    threads[current_tid].heap_index = -1;
+}
+
+static void cfs_create(Tid tid){
+    threads[tid].vruntime = cfs_min_vruntime;
+    threads[tid].heap_index = -1;
+}
+
+static void cfs_stop(Tid tid){
+    cfs_charge();
+}
+
+/* the idle time is charged to no thread */
+static void cfs_idle(void){
+    cfs_start = cfs_now();
+}
+
+static void cfs_ready(Tid tid){
+    struct thread * t = &threads[tid];
+    uint64_t floor = cfs_min_vruntime - CFS_SLEEP_CREDIT_NS;
+
+    if (cfs_min_vruntime > CFS_SLEEP_CREDIT_NS && (int64_t)(t->vruntime - floor) < 0){
+        t->vruntime = floor;
+    }
+    cfs_len += 1;
+    cfs_place(cfs_len - 1, tid);
+    cfs_sift_up(cfs_len - 1);
+}
+
+static Tid cfs_remove(Tid tid){
+    if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid].heap_index < 0){
+        return THREAD_INVALID;
+    }
+    int i = threads[tid].heap_index;
+    threads[tid].heap_index = -1;
+    cfs_len -= 1;
+    if (i < cfs_len){
+        Tid last = cfs_heap[cfs_len];
+        cfs_place(i, last);
+        if (i > 0 && cfs_before(last, cfs_heap[(i - 1) / 2])){
+            cfs_sift_up(i);
         }
         else{
-            pre_node->next = node->next;
-            free(node);
+            cfs_sift_down(i);
+        }
+    }
+    return tid;
+}
 
-            if (pre_node->next == NULL){
-                q->tail = pre_node;
-            }
+static Tid cfs_next(void){
+    if (cfs_len == 0){
+        return THREAD_NONE;
+    }
+    return cfs_remove(cfs_heap[0]);
+}
+
+static int cfs_tick(void){
+    cfs_charge();
+    return cfs_len > 0 &&
+        (int64_t)(threads[current_tid].vruntime - threads[cfs_heap[0]].vruntime) > CFS_GRANULARITY_NS;
+}
+
+static int cfs_empty(void){
+    return cfs_len == 0;
+}
+
+//-----------------------------------------------------------------------
+// Work stealing, for thread_init_workers(): each worker keeps its ready
+// threads in a Chase-Lev deque. Only the owner pushes, at the bottom, with
+// no atomic read-modify-write. Threads are taken from the top with a CAS,
+// by the owner, so that the threads of a worker run round robin, and by
+// other workers stealing when they run out. Whoever moves a thread from
+// READY to RUNNING runs it, which lets a directed yield claim a thread
+// wherever its entry is: the entry stays behind, is skipped when taken,
+// and is dropped by ws_compact() if the deque fills up.
+//
+// Idle workers park on a futex, and are woken by ws_kick() when threads are
+// made ready.
+
+int work_seq;               /* bumped whenever a thread is made ready */
+int nparked;                /* idle workers waiting on work_seq */
+
+static int deque_push(struct deque * d, Tid tid){
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= DEQUE_SIZE){
+        return -1;
+    }
+    __atomic_store_n(&d->buf[b % DEQUE_SIZE], tid, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Takes the top entry. Returns THREAD_NONE if the deque is empty, and
+ * THREAD_FAILED if another worker took it first. */
+static Tid deque_take(struct deque * d){
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b){
+        return THREAD_NONE;
+    }
+    Tid tid = __atomic_load_n(&d->buf[t % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+        return THREAD_FAILED;
+    }
+    return tid;
+}
+
+/* Takes the bottom entry; owner only */
+static Tid deque_pop(struct deque * d){
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b){
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return THREAD_NONE;
+    }
+    Tid tid = __atomic_load_n(&d->buf[b % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (t == b){
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+            tid = THREAD_NONE;
         }
-        interrupts_set(enabled);
-        return tid;
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return tid;
+}
+
+static int ws_claim(Tid tid){
+    enum state_t expected = READY;
+    return __atomic_compare_exchange_n(&threads[tid].state, &expected, RUNNING, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* Drops the entries of threads that are no longer ready, and duplicates,
+ * from the deque of worker w */
+static void ws_compact(struct worker * w){
+    uint64_t seen[THREAD_MAX_THREADS / 64] = { 0 };
+    int n = 0;
+    Tid tid;
+
+    while ((tid = deque_pop(&w->deque)) != THREAD_NONE){
+        uint64_t bit = 1ULL << (tid % 64);
+        if (__atomic_load_n(&threads[tid].state, __ATOMIC_ACQUIRE) == READY &&
+            !(seen[tid / 64] & bit)){
+            seen[tid / 64] |= bit;
+            w->scratch[n++] = tid;
+        }
+    }
+    /* popped from the bottom, so push back in reverse */
+    while (n > 0){
+        deque_push(&w->deque, w->scratch[--n]);
+    }
+}
+
+static void ws_kick(void){
+    __atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&nparked, __ATOMIC_SEQ_CST) > 0){
+        syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Waits until a thread is made ready after work_seq was read as seq */
+static void ws_park(int seq){
+    struct timespec timeout = { 0, 10000000 };
+
+    __atomic_add_fetch(&nparked, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+    __atomic_sub_fetch(&nparked, 1, __ATOMIC_SEQ_CST);
+}
+
+static void ws_init(void){
+    for (int i = 0; i < THREAD_MAX_WORKERS; i++){
+        workers[i].deque.top = workers[i].deque.bottom = 0;
+    }
+}
+
+static void ws_ready(Tid tid){
+    struct worker * w = worker_self();
+    if (deque_push(&w->deque, tid) != 0){
+        ws_compact(w);
+        int err = deque_push(&w->deque, tid);
+        assert(!err);
+    }
+    if (nworkers > 1){
+        ws_kick();
+    }
+}
+
+static Tid ws_take(struct deque * d){
+    Tid tid;
+    while ((tid = deque_take(d)) != THREAD_NONE){
+        if (tid != THREAD_FAILED && ws_claim(tid)){
+            return tid;
+        }
+    }
+    return THREAD_NONE;
+}
+
+static Tid ws_next(void){
+    int self = worker_self() - workers;
+    Tid tid = ws_take(&workers[self].deque);
+    for (int i = 1; tid == THREAD_NONE && i < nworkers; i++){
+        tid = ws_take(&workers[(self + i) % nworkers].deque);
+    }
+    return tid;
+}
+
+static Tid ws_remove(Tid tid){
+    if (tid < 0 || tid >= THREAD_MAX_THREADS || !ws_claim(tid)){
+        return THREAD_INVALID;
+    }
+    return tid;
+}
+
+/* not one of the THREAD_SCHED_* policies: it is chosen by
+ * thread_init_workers() */
+#define SCHED_WORK_STEALING (THREAD_SCHED_FAIR + 1)
+#define NUM_SCHED_POLICIES SCHED_WORK_STEALING
+
+static const struct sched_policy sched_policies[] = {
+    [THREAD_SCHED_FIFO] = { "fifo", fifo_init, fifo_ready, fifo_next, fifo_remove,
+                            NULL, NULL, NULL, NULL, NULL },
+    [THREAD_SCHED_MLFQ] = { "mlfq", mlfq_init, mlfq_ready, mlfq_next, mlfq_remove,
+                            mlfq_create, NULL, mlfq_tick, mlfq_empty, NULL },
+    [THREAD_SCHED_FAIR] = { "fair", cfs_init, cfs_ready, cfs_next, cfs_remove,
+                            cfs_create, cfs_stop, cfs_tick, cfs_empty, cfs_idle },
+    [SCHED_WORK_STEALING] = { "ws", ws_init, ws_ready, ws_next, ws_remove,
+                              NULL, NULL, NULL, NULL, NULL },
+};
+
+//-----------------------------------------------------------------------
+// Timeouts, for thread_sleep_for() and the *_timeout() waits. A blocked
+// thread has at most one, kept in its control block on a hierarchical
+// timing wheel: WHEEL_LEVELS levels of WHEEL_SIZE slots, where a slot of
+// level l covers WHEEL_SIZE^l wheel units. A timeout goes in the lowest
+// level whose range reaches it, and is moved down a level (cascaded) when
+// the level below wraps around to its slot, so arming and cancelling are
+// O(1) and each timeout is touched at most once per level.
+//
+// The wheel is advanced to the current time by every timer tick while
+// timeouts are pending (which keeps ticks from stopping), and by
+// wheel_idle() when every thread is blocked. Timeouts fire to the wheel
+// unit, at least the requested time after they were armed.
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4          /* with 200 us units, about 55 minutes */
+#define WHEEL_UNIT_NS (SIG_INTERVAL * 1000ULL)
+#define WHEEL_NEVER UINT64_MAX  /* deadline of an untimed wait */
+
+Tid wheel[WHEEL_LEVELS * WHEEL_SIZE];   /* first timeout in each slot */
+uint64_t wheel_now;                     /* time the wheel has reached */
+int wheel_count;                        /* timeouts armed */
+queue_t * sleep_queue;                  /* threads in thread_sleep_for() */
+
+/* The current time in wheel units */
+static uint64_t wheel_time(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) / WHEEL_UNIT_NS;
+}
+
+/* The wheel time at least usecs from now; in the past if usecs is 0 */
+static uint64_t wheel_deadline(long usecs){
+    struct timespec ts;
+    if (usecs == 0){
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + usecs * 1000ULL;
+    return (ns + WHEEL_UNIT_NS - 1) / WHEEL_UNIT_NS;
+}
+
+static void wheel_insert(Tid tid){
+    struct thread * t = &threads[tid];
+    uint64_t expires = t->t_expires;
+    uint64_t delta = expires - wheel_now;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >= 1ULL << (WHEEL_BITS * (level + 1))){
+        level++;
+    }
+    if (delta >= 1ULL << (WHEEL_BITS * WHEEL_LEVELS)){
+        /* beyond the wheel: park it in the furthest slot, to be cascaded
+         * back until it is in range */
+        expires = wheel_now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    int slot = level * WHEEL_SIZE + ((expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+
+    t->t_slot = slot;
+    t->t_prev = THREAD_NONE;
+    t->t_next = wheel[slot];
+    if (t->t_next != THREAD_NONE){
+        threads[t->t_next].t_prev = tid;
+    }
+    wheel[slot] = tid;
+}
+
+static void wheel_unlink(Tid tid){
+    struct thread * t = &threads[tid];
+    if (t->t_prev == THREAD_NONE){
+        wheel[t->t_slot] = t->t_next;
+    }
+    else{
+        threads[t->t_prev].t_next = t->t_next;
+    }
+    if (t->t_next != THREAD_NONE){
+        threads[t->t_next].t_prev = t->t_prev;
+    }
+    t->t_slot = -1;
+}
+
+/* Arms a timeout for tid at wheel time expires, with sched_lock() held */
+static void timer_arm(Tid tid, uint64_t expires){
+    if (wheel_count == 0){
+        /* the wheel stands still while empty */
+        wheel_now = wheel_time();
+    }
+    if (expires <= wheel_now){
+        expires = wheel_now + 1;
+    }
+    threads[tid].t_expires = expires;
+    threads[tid].timed_out = 0;
+    wheel_insert(tid);
+    wheel_count++;
+    /* ticks are needed to advance the wheel */
+    interrupts_tick_resume();
+}
+
+static void timer_cancel(Tid tid){
+    if (threads[tid].t_slot >= 0){
+        wheel_unlink(tid);
+        wheel_count--;
+    }
+}
+
+/* Fires the timeout of tid: a thread blocked on a queue is taken off it and
+ * made ready, and finds timed_out set */
+static void timer_fire(Tid tid){
+    struct thread * t = &threads[tid];
+
+    timer_cancel(tid);
+    t->timed_out = 1;
+    if (t->state == BLOCK){
+        if (t->queue != NULL){
+            queue_remove(t->queue, tid);
+        }
+        t->state = READY;
+        num_thr += 1;
+        sched->ready(tid);
+    }
+}
+
+/* Moves the timeouts in the current slot of level down the wheel. Returns
+ * the slot's index within the level. */
+static int wheel_cascade(int level){
+    int index = (wheel_now >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+    Tid tid = wheel[level * WHEEL_SIZE + index];
+
+    wheel[level * WHEEL_SIZE + index] = THREAD_NONE;
+    while (tid != THREAD_NONE){
+        Tid next = threads[tid].t_next;
+        wheel_insert(tid);
+        tid = next;
+    }
+    return index;
+}
+
+/* Advances the wheel to time now, firing the timeouts that expire on the
+ * way, with sched_lock() held */
+static void wheel_advance(uint64_t now){
+    while (wheel_count > 0 && wheel_now < now){
+        wheel_now++;
+        int index = wheel_now & (WHEEL_SIZE - 1);
+        for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++){
+            index = wheel_cascade(level);
+        }
+        Tid tid;
+        while ((tid = wheel[wheel_now & (WHEEL_SIZE - 1)]) != THREAD_NONE){
+            timer_fire(tid);
+        }
+    }
+    if (wheel_now < now){
+        wheel_now = now;
     }
 }
-/* End of ready queue implementation*/
-
 
-enum state_t{READY, RUNNING, NOTVALID, BLOCK};
+/* Waits for the next wheel unit and advances the wheel, with sched_lock()
+ * held, when no thread can run until a timeout fires */
+static void wheel_idle(void){
+    uint64_t next = (wheel_time() + 1) * WHEEL_UNIT_NS;
+    struct timespec ts = { next / 1000000000ULL, next % 1000000000ULL };
+
+    int depth = sched_lock_drop();
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    sched_lock_retake(depth);
+    wheel_advance(wheel_time());
+    if (sched->idle != NULL){
+        sched->idle();
+    }
+}
 
-/* This is the thread control block */
-struct thread {
-    /* ... Fill this in ... */
-    enum state_t state;
-    ucontext_t context;
-    int setcontext_called;
-    int be_killed;
-    int exit_code;
-    queue_t * wait_queue;
-};
+//-----------------------------------------------------------------------
 
-struct thread threads[THREAD_MAX_THREADS];
-volatile Tid current_tid;
-volatile unsigned num_thr;
-queue_t * ready_queue;
-queue_t * exit_queue;
-Tid recent_tid;
+static void * new_frame(struct stack * s, void * fn, void * arg0, void * arg1);
+static void worker_idle(struct worker * w);
+static void lock_pass(struct lock *lock);
+static void * worker_main(void * arg);
 
 void
 thread_init(void)
 {
+    const char * name = getenv("THREAD_SCHED");
+    const char * nworkers_env = getenv("THREAD_WORKERS");
+    int policy = THREAD_SCHED_FIFO;
+
+    if (nworkers_env != NULL){
+        int n = atoi(nworkers_env);
+        if (n < 1 || n > THREAD_MAX_WORKERS){
+            fprintf(stderr, "THREAD_WORKERS: must be between 1 and %d\n", THREAD_MAX_WORKERS);
+            exit(1);
+        }
+        if (n > 1){
+            if (name != NULL){
+                fprintf(stderr, "THREAD_WORKERS: cannot be combined with THREAD_SCHED\n");
+                exit(1);
+            }
+            thread_init_workers(n);
+            return;
+        }
+    }
+
+    if (name != NULL){
+        for (policy = 0; policy < NUM_SCHED_POLICIES; policy++){
+            if (strcmp(name, sched_policies[policy].name) == 0){
+                break;
+            }
+        }
+        if (policy == NUM_SCHED_POLICIES){
+            fprintf(stderr, "THREAD_SCHED: unknown scheduling policy %s\n", name);
+            exit(1);
+        }
+    }
+    thread_init_sched(policy);
+}
+
+static void
+thread_init_common(int policy)
+{
+    for (int i = 0; i < THREAD_MAX_WORKERS; i++){
+        workers[i].current = workers[i].prev = workers[i].pending = THREAD_NONE;
+    }
+
     /* Add necessary initialization for your threads library here. */
 	/* Initialize the thread control block for the first thread */\
     recent_tid = 0;
     current_tid = 0;
     threads[0].state = RUNNING;
-    threads[0].setcontext_called = 0;
+    threads[0].on_cpu = 1;
     threads[0].be_killed = 0;
+    threads[0].handoff = NULL;
     threads[0].wait_queue = wait_queue_create();
     threads[0].exit_code = -1;
+    threads[0].weight = THREAD_WEIGHT_DEFAULT;
+    threads[0].queue = NULL;
+    threads[0].stack.base = NULL;   /* runs on the process stack */
+    threads[0].t_slot = -1;
     num_thr = 1;
-    ready_queue = queue_initialize();
+    page_size = sysconf(_SC_PAGESIZE);
     exit_queue = queue_initialize();
+    sched = &sched_policies[policy];
+    sched->init();
 
     /*initial other threads blocks*/
     for (int i = 1; i < THREAD_MAX_THREADS; i++){
         threads[i].state = NOTVALID;
-        threads[i].setcontext_called = 0;
+        threads[i].queue = NULL;
+        threads[i].t_slot = -1;
+        tid_release(i);
+    }
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++){
+        wheel[i] = THREAD_NONE;
+    }
+    wheel_count = 0;
+    sleep_queue = queue_initialize();
+}
+
+void
+thread_init_sched(int policy)
+{
+    assert(policy >= 0 && policy < NUM_SCHED_POLICIES);
+    thread_init_common(policy);
+}
+
+void
+thread_init_workers(int n)
+{
+    assert(n >= 1 && n <= THREAD_MAX_WORKERS);
+    thread_init_common(SCHED_WORK_STEALING);
+
+    /* worker 0 is this kernel thread, which runs thread 0, so its idle
+     * context needs a stack of its own */
+    struct stack idle_stack;
+    int err = stack_get(THREAD_MIN_STACK + page_size, &idle_stack);
+    assert(!err);
+    workers[0].idle_sp = new_frame(&idle_stack, worker_idle, &workers[0], NULL);
+    register_interrupt_thread();
+
+    /* the other workers start in their idle context, on their own kernel
+     * thread, with interrupts disabled as they inherit this mask */
+    nworkers = n;
+    int enabled = interrupts_off();
+    for (int i = 1; i < n; i++){
+        err = pthread_create(&workers[i].pthread, NULL, worker_main, &workers[i]);
+        assert(!err);
     }
-    int err = getcontext(&threads[0].context);
-	assert(!err);
+    interrupts_set(enabled);
 }
 
 Tid
@@ -163,12 +1127,190 @@ thread_id()
     return current_tid;
 }
 
+/* Thread switches are done by thread_switch, which pushes the callee-saved
+ * registers and the SSE and x87 control words on the current stack, saves
+ * the stack pointer in *save_sp, loads new_sp and pops the same in reverse,
+ * returning to wherever the other thread called thread_switch. Unlike
+ * getcontext/setcontext it makes no system call: switches always happen with
+ * interrupts disabled, and the thread switched to restores its own signal
+ * mask with interrupts_set() (or interrupts_on() when it is new).
+ *
+ * A new context's stack is laid out as if it had called thread_switch from
+ * thread_start, which calls the function in r12 with the arguments in r13
+ * and r14: thread_stub(fn, arg) for a user thread, worker_idle(worker) for
+ * the idle context of a worker (see new_frame). */
+void thread_switch(void **save_sp, void *new_sp);
+void thread_start(void);
+void thread_stub(void (*thread_main)(void *), void *arg);
+
+__asm__(
+    ".text\n"
+    ".globl thread_switch\n"
+    ".type thread_switch, @function\n"
+    "thread_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size thread_switch, .-thread_switch\n"
+    "\n"
+    ".globl thread_start\n"
+    ".type thread_start, @function\n"
+    "thread_start:\n"
+    "    movq %r13, %rdi\n"
+    "    movq %r14, %rsi\n"
+    "    call *%r12\n"
+    "    ud2\n"
+    ".size thread_start, .-thread_start\n"
+);
+
+/* Initial control words for a new thread: MXCSR 0x1f80 and x87 0x037f, all
+ * exceptions masked and round to nearest */
+#define FP_CONTROL_INIT (0x1f80ULL | 0x037fULL << 32)
+
+/* Lays out the frame that thread_switch pops at the top of stack s, so that
+ * switching to the returned stack pointer calls fn(arg0, arg1) */
+static void * new_frame(struct stack * s, void * fn, void * arg0, void * arg1){
+    uint64_t *frame = (uint64_t *)((char *)s->base + s->size) - 8;
+    frame[0] = FP_CONTROL_INIT;
+    frame[1] = 0;                   /* r15 */
+    frame[2] = (uint64_t)arg1;      /* r14 */
+    frame[3] = (uint64_t)arg0;      /* r13 */
+    frame[4] = (uint64_t)fn;        /* r12 */
+    frame[5] = 0;                   /* rbx */
+    frame[6] = 0;                   /* rbp */
+    frame[7] = (uint64_t)&thread_start;
+    return frame;
+}
+
+/* Tells the policy that the running thread is about to be switched out */
+static void sched_stop(void){
+    if (sched->stop != NULL){
+        sched->stop(current_tid);
+    }
+}
+
+/* Runs first on the stack switched to after every switch. The thread
+ * switched out is saved now, so another worker may run it, or its stack be
+ * freed if it exited. */
+static void finish_switch(void){
+    struct worker * w = worker_self();
+    if (w->prev != THREAD_NONE){
+        __atomic_store_n(&threads[w->prev].on_cpu, 0, __ATOMIC_RELEASE);
+        w->prev = THREAD_NONE;
+    }
+}
+
+/* Switches from the running thread to tid, which has been taken off the
+ * ready set, or to the worker's idle context if tid is THREAD_NONE. If
+ * another worker is still switching tid out, the idle context waits for it
+ * and then runs tid, so that this thread is saved meanwhile and cannot
+ * deadlock with a switch the other way. Returns when the thread runs again,
+ * possibly on another worker. */
+static void switch_out(Tid tid){
+    struct worker * w = worker_self();
+    Tid self = w->current;
+
+    w->prev = self;
+    if (tid == THREAD_NONE || __atomic_load_n(&threads[tid].on_cpu, __ATOMIC_ACQUIRE)){
+        assert(w->idle_sp != NULL);
+        w->pending = tid;
+        w->current = THREAD_NONE;
+        thread_switch(&threads[self].sp, w->idle_sp);
+    }
+    else{
+        threads[tid].on_cpu = 1;
+        w->current = tid;
+        w->switches++;
+        thread_switch(&threads[self].sp, threads[tid].sp);
+    }
+    finish_switch();
+}
+
+/* Switches from the current thread to tid as switch_out() does, with
+ * interrupts disabled, dropping sched_lock() for the switch if it is held.
+ * Returns when a thread switches back to this one, after freeing exited
+ * threads; a thread killed meanwhile exits instead. */
+static void switch_to(Tid tid){
+    Tid self = current_tid;
+    int depth = sched_lock_drop();
+    switch_out(tid);
+    sched_lock_retake(depth);
+
+    if (__atomic_load_n(&exit_queue->head, __ATOMIC_RELAXED) != THREAD_NONE){
+        free_exit_threads(exit_queue);
+    }
+    if (threads[self].be_killed == 1){
+        thread_exit(THREAD_KILLED);
+    }
+    threads[self].state = RUNNING;
+}
+
+/* The idle context of worker w, run when it has no user thread: it runs the
+ * thread left in w->pending, or the next ready one, or parks until a thread
+ * is made ready. It runs with interrupts disabled throughout. */
+static void worker_idle(struct worker * w){
+    finish_switch();
+    for (;;){
+        Tid tid = w->pending;
+        if (tid == THREAD_NONE){
+            if (__atomic_load_n(&exit_queue->head, __ATOMIC_RELAXED) != THREAD_NONE){
+                free_exit_threads(exit_queue);
+            }
+            int seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+            tid = sched->next();
+            if (tid == THREAD_NONE){
+                ws_park(seq);
+                continue;
+            }
+        }
+        w->pending = THREAD_NONE;
+
+        int spins = 0;
+        while (__atomic_load_n(&threads[tid].on_cpu, __ATOMIC_ACQUIRE)){
+            spin_pause(&spins);
+        }
+        threads[tid].on_cpu = 1;
+        w->current = tid;
+        w->switches++;
+        thread_switch(&w->idle_sp, threads[tid].sp);
+        finish_switch();
+    }
+}
+
+static void * worker_main(void * arg){
+    struct worker * w = arg;
+
+    self_worker = w;
+    register_interrupt_thread();
+    worker_idle(w);
+    return NULL;
+}
+
 /* New thread starts by calling thread_stub. The arguments to thread_stub are
  * the thread_main() function, and one argument to the thread_main() function. 
  */
 void
 thread_stub(void (*thread_main)(void *), void *arg)
 {
+    finish_switch();
     interrupts_on();
 	thread_main(arg); // call thread_main() function with arg
 	thread_exit(0);
@@ -177,67 +1319,70 @@ thread_stub(void (*thread_main)(void *), void *arg)
 Tid
 thread_create(void (*fn) (void *), void *parg)
 {
-    int enabled = interrupts_set(0);
-    if (num_thr == THREAD_MAX_THREADS){
-        interrupts_set(enabled);
+    return thread_create_stack(fn, parg, THREAD_MIN_STACK);
+}
+
+Tid
+thread_create_stack(void (*fn) (void *), void *parg, size_t stack_size)
+{
+    int enabled = sched_lock();
+    /* an exited thread's tid may be reused below, so it must be off the
+     * exit queue first */
+    free_exit_threads(exit_queue);
+    /* tids are handed out round-robin from the last one created */
+    Tid tid = tid_find(recent_tid + 1);
+    if (tid == THREAD_NOMORE){
+        sched_unlock(enabled);
         return THREAD_NOMORE;
     }
-    Tid tid = -1;
-    for (int i = recent_tid + 1; i < THREAD_MAX_THREADS; i++){
-        if (threads[i].state == NOTVALID){
-            tid = i;
-            break;
-        }
-    }
-    if (tid == -1){
-        for (int i = 0; i < THREAD_MAX_THREADS; i++){
-            if (threads[i].state == NOTVALID){
-                tid = i;
-                break;
-            }
-        }
-    }
-    recent_tid = tid;
 
     /*initialize the new thread block*/
-    void *sp = malloc(THREAD_MIN_STACK);
-    if (sp == NULL) {
-        interrupts_set(enabled);
+    if (stack_size < THREAD_MIN_STACK){
+        stack_size = THREAD_MIN_STACK;
+    }
+    stack_size = (stack_size + page_size - 1) & ~(page_size - 1);
+    if (stack_get(stack_size + page_size, &threads[tid].stack) != 0){
+        sched_unlock(enabled);
         return THREAD_NOMEMORY;
     }
-    threads[tid].setcontext_called = 0;
+    tid_take(tid);
+    recent_tid = tid;
     threads[tid].be_killed = 0;
-    threads[tid].state = READY;
+    threads[tid].handoff = NULL;
+    threads[tid].on_cpu = 0;
     threads[tid].wait_queue = wait_queue_create();
     threads[tid].exit_code = -1;
-	assert(!getcontext(&threads[tid].context));
+    threads[tid].weight = THREAD_WEIGHT_DEFAULT;
+    threads[tid].sp = new_frame(&threads[tid].stack, thread_stub, fn, parg);
 
-    threads[tid].context.uc_mcontext.gregs[REG_RIP] = (greg_t) &thread_stub;
-    threads[tid].context.uc_mcontext.gregs[REG_RDI] = (greg_t) fn;
-    threads[tid].context.uc_mcontext.gregs[REG_RSI] = (greg_t) parg;
-
-    threads[tid].context.uc_stack.ss_sp = sp;
-    /* rsp point to the start of stack frame*/
-    threads[tid].context.uc_mcontext.gregs[REG_RSP] = (greg_t)sp + THREAD_MIN_STACK;
-    threads[tid].context.uc_mcontext.gregs[REG_RSP] -= threads[tid].context.uc_mcontext.gregs[REG_RSP] % 16; // aligned to 16 bytes
-    // leave space for old rip
-    threads[tid].context.uc_mcontext.gregs[REG_RSP] -= 8;
-
-    queue_enq(ready_queue, tid);
+    if (sched->create != NULL){
+        sched->create(tid);
+    }
+    /* last, as another worker may run it as soon as it is READY */
+    threads[tid].state = READY;
+    sched->ready(tid);
+    interrupts_tick_resume();
     num_thr += 1;
-    interrupts_set(enabled);
+    sched_unlock(enabled);
     return tid;
 }
 
 void free_exit_threads(queue_t * q){
-    int enabled = interrupts_set(0);
-    while (q->root != NULL){
-        Tid tid = queue_deq(q);
-        free(threads[tid].context.uc_stack.ss_sp);
-        wait_queue_destroy(threads[tid].wait_queue);
-        threads[tid].wait_queue = NULL;
+    int enabled = sched_lock();
+    Tid tid = q->head;
+    while (tid != THREAD_NONE){
+        Tid next = threads[tid].q_next;
+        /* its stack is in use until the switch away from it is finished */
+        if (!__atomic_load_n(&threads[tid].on_cpu, __ATOMIC_ACQUIRE)){
+            queue_remove(q, tid);
+            stack_put(&threads[tid].stack);
+            wait_queue_destroy(threads[tid].wait_queue);
+            threads[tid].wait_queue = NULL;
+            tid_release(tid);
+        }
+        tid = next;
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 }
 
 Tid
@@ -250,11 +1395,11 @@ thread_yield(Tid want_tid){
         return current_tid;
     }
     else if (want_tid == THREAD_ANY){
-        if (ready_queue->root == NULL){
+        tid = sched->next();
+        if (tid == THREAD_NONE){
             interrupts_set(enabled);
             return THREAD_NONE;
         }
-        tid = queue_deq(ready_queue);
 
 
     }
@@ -263,7 +1408,7 @@ thread_yield(Tid want_tid){
             interrupts_set(enabled);
             return THREAD_INVALID;
         }
-        tid = queue_exact(ready_queue, want_tid);
+        tid = sched->remove(want_tid);
         if (tid < 0){
             interrupts_set(enabled);
             return tid;
@@ -274,65 +1419,111 @@ thread_yield(Tid want_tid){
         return THREAD_INVALID;
     }
 
-    int err = getcontext(&threads[current_tid].context);
-    assert(!err);
-    free_exit_threads(exit_queue);
-    if (threads[current_tid].setcontext_called == 1){
-        if (threads[current_tid].be_killed == 1){
-            thread_exit(THREAD_KILLED);
+    sched_stop();
+    threads[current_tid].state = READY;
+    sched->ready(current_tid);
+    switch_to(tid);
+    interrupts_set(enabled);
+    return tid;
+}
+
+Tid
+thread_set_weight(Tid tid, int weight)
+{
+    int enabled = sched_lock();
+    if (tid == THREAD_SELF){
+        tid = current_tid;
+    }
+    if (tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid].state == NOTVALID || weight <= 0){
+        sched_unlock(enabled);
+        return THREAD_INVALID;
+    }
+    threads[tid].weight = weight;
+    sched_unlock(enabled);
+    return tid;
+}
+
+unsigned long
+thread_switches(void)
+{
+    unsigned long switches = 0;
+    for (int i = 0; i < nworkers; i++){
+        switches += __atomic_load_n(&workers[i].switches, __ATOMIC_RELAXED);
+    }
+    return switches;
+}
+
+/* Called on every timer interrupt, with interrupts disabled. When there is
+ * nothing else to run and no timeout pending, ticks are stopped until a
+ * thread is made ready. */
+void
+thread_tick(void)
+{
+    if (__atomic_load_n(&wheel_count, __ATOMIC_RELAXED) > 0){
+        int enabled = sched_lock();
+        wheel_advance(wheel_time());
+        sched_unlock(enabled);
+    }
+    if (sched->tick == NULL || sched->tick()){
+        if (thread_yield(THREAD_ANY) == THREAD_NONE && wheel_count == 0){
+            interrupts_tick_stop();
         }
-        threads[current_tid].setcontext_called = 0;
-        threads[current_tid].state = RUNNING;
-        interrupts_set(enabled);
-        return tid;
     }
-    threads[current_tid].setcontext_called = 1;
-    threads[current_tid].state = READY;
-    queue_enq(ready_queue, current_tid);
-    current_tid = tid;
-    setcontext(&threads[tid].context);
-    return THREAD_FAILED;
+    else if (sched->empty() && wheel_count == 0){
+        /* not preempted, but running alone until a thread is made ready */
+        interrupts_tick_stop();
+    }
 }
 
 void
 thread_exit(int exit_code)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     threads[current_tid].state = NOTVALID;
 
-    threads[current_tid].setcontext_called = 0;
     threads[current_tid].be_killed = 0;
+    /* killed after a lock was handed to it, before it ran to take it */
+    if (threads[current_tid].handoff != NULL){
+        lock_pass(threads[current_tid].handoff);
+    }
     queue_enq(exit_queue, current_tid);
-    queue_exact(ready_queue, current_tid);
-    queue_node_t * waiting_node = threads[current_tid].wait_queue->root;
-    while (waiting_node != NULL){
-        if (threads[waiting_node->tid].be_killed == 0){
-            threads[waiting_node->tid].exit_code = exit_code;
+    sched->remove(current_tid);
+    Tid waiting = threads[current_tid].wait_queue->head;
+    while (waiting != THREAD_NONE){
+        if (threads[waiting].be_killed == 0){
+            threads[waiting].exit_code = exit_code;
             break;
         }
-        waiting_node = waiting_node->next;
+        waiting = threads[waiting].q_next;
     }
     thread_wakeup(threads[current_tid].wait_queue, 1);
     num_thr -= 1;
-    Tid tid = queue_deq(ready_queue);
-    if (tid == THREAD_NONE){
-        interrupts_set(enabled);
+    /* the threads left may all be waiting for timeouts */
+    while (num_thr == 0 && wheel_count > 0){
+        wheel_idle();
+    }
+    if (num_thr == 0){
+        sched_unlock(enabled);
         exit(exit_code);
     }
-    current_tid = tid;
-    setcontext(&threads[tid].context);
+    /* with several workers, the others may be running every thread left */
+    Tid tid = sched->next();
+    sched_stop();
+    sched_lock_drop();
+    switch_out(tid);
+    assert(0);  /* an exited thread is never switched back to */
 }
 
 Tid
 thread_kill(Tid tid)
 {   
-    int enabled = interrupts_set(0);
-    if (tid == current_tid || tid < 0 || tid > THREAD_MAX_THREADS || (threads[tid].state != READY && threads[tid].state != BLOCK)){
-        interrupts_set(enabled);
+    int enabled = sched_lock();
+    if (tid == current_tid || tid < 0 || tid >= THREAD_MAX_THREADS || threads[tid].state == NOTVALID){
+        sched_unlock(enabled);
         return THREAD_INVALID;
     }
     threads[tid].be_killed = 1;
-    interrupts_set(enabled);
+    sched_unlock(enabled);
     return tid;
 }
 
@@ -344,59 +1535,113 @@ thread_kill(Tid tid)
 struct wait_queue *
 wait_queue_create()
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     struct wait_queue *wq;
 
     wq = malloc(sizeof(struct wait_queue));
     assert(wq);
 
-    wq->root = wq->tail = NULL;
-    interrupts_set(enabled);
+    wq->head = wq->tail = THREAD_NONE;
+    sched_unlock(enabled);
     return wq;
 }
 
 void
 wait_queue_destroy(struct wait_queue *wq)
 {
-    while(wq->root != NULL){
+    int enabled = sched_lock();
+    while(wq->head != THREAD_NONE){
         queue_deq(wq);
     }
     free(wq);
+    sched_unlock(enabled);
 }
 
 Tid
 thread_sleep(struct wait_queue *queue)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     if (queue == NULL){
-        interrupts_set(enabled);
+        sched_unlock(enabled);
         return THREAD_INVALID;
     }
 
-    Tid tid = queue_deq(ready_queue);
-    if (tid < 0){
-        interrupts_set(enabled);
+    /* with several workers, there may be none ready while others run */
+    Tid tid = sched->next();
+    if (tid == THREAD_NONE && num_thr == 1 && wheel_count == 0){
+        sched_unlock(enabled);
         return THREAD_NONE;
     }
 
-    getcontext(&threads[current_tid].context);
-    free_exit_threads(exit_queue);
-    if (threads[current_tid].setcontext_called == 1){
-        if (threads[current_tid].be_killed == 1){
+    sched_stop();
+    Tid self = current_tid;
+    threads[self].state = BLOCK;
+    queue_enq(queue, self);
+    num_thr -= 1;
+    /* every thread is blocked, until a timeout makes one ready */
+    while (tid == THREAD_NONE && num_thr == 0){
+        wheel_idle();
+        tid = sched->next();
+    }
+    if (tid == self){
+        /* it was our own timeout */
+        threads[self].state = RUNNING;
+        if (threads[self].be_killed == 1){
             thread_exit(THREAD_KILLED);
         }
-        threads[current_tid].setcontext_called = 0;
-        threads[current_tid].state = RUNNING;
-        interrupts_set(enabled);
-        return tid;
     }
-    threads[current_tid].state = BLOCK;
-    queue_enq(queue, current_tid);
-    threads[current_tid].setcontext_called = 1;
-    current_tid = tid;
-    num_thr -= 1;
-    setcontext(&threads[tid].context);
-    interrupts_set(enabled);
+    else{
+        switch_to(tid);
+    }
+    sched_unlock(enabled);
+    return tid == THREAD_NONE ? self : tid;
+}
+
+/* thread_sleep with a timeout at wheel time expires (WHEEL_NEVER for none),
+ * with sched_lock() held. Returns 1 if it timed out, without sleeping if
+ * expires has passed, and 0 if it was woken up. */
+static int thread_sleep_until(struct wait_queue *queue, uint64_t expires){
+    Tid self = current_tid;
+
+    if (expires == WHEEL_NEVER){
+        thread_sleep(queue);
+        return 0;
+    }
+    if (expires <= wheel_time()){
+        return 1;
+    }
+    timer_arm(self, expires);
+    thread_sleep(queue);
+    timer_cancel(self);
+    return threads[self].timed_out;
+}
+
+int
+thread_sleep_for(long usecs)
+{
+    if (usecs < 0){
+        return THREAD_INVALID;
+    }
+    int enabled = sched_lock();
+    thread_sleep_until(sleep_queue, wheel_deadline(usecs));
+    sched_unlock(enabled);
+    return 0;
+}
+
+/* Wakes up the first thread in queue that has not been killed, with
+ * sched_lock() held. Returns its tid, or THREAD_NONE if there is none. */
+static Tid wakeup_one(struct wait_queue *queue){
+    Tid tid = queue_deq(queue);
+    while (tid != THREAD_NONE && threads[tid].be_killed == 1){
+        tid = queue_deq(queue);
+    }
+    if (tid != THREAD_NONE){
+        timer_cancel(tid);
+        threads[tid].state = READY;
+        num_thr += 1;
+        sched->ready(tid);
+        interrupts_tick_resume();
+    }
     return tid;
 }
 
@@ -405,62 +1650,72 @@ thread_sleep(struct wait_queue *queue)
 int
 thread_wakeup(struct wait_queue *queue, int all)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     if (queue == NULL){
-        interrupts_set(enabled);
+        sched_unlock(enabled);
         return 0;
     }
     if (all == 0){
-        Tid tid = queue_deq(queue);
-        if (tid == THREAD_NONE){
-            interrupts_set(enabled);
-            return 0;
-        }
-        else{
-            while (threads[tid].be_killed == 1){
-                tid = queue_deq(queue);
-            }
-            threads[tid].state = READY;
-            num_thr += 1;
-            queue_enq(ready_queue, tid);
-            interrupts_set(enabled);
-            return 1;
-        }
+        Tid tid = wakeup_one(queue);
+        sched_unlock(enabled);
+        return tid != THREAD_NONE;
     }
     else if (all == 1){
         int count = 0;
         while (thread_wakeup(queue, 0) != 0){
             count += 1;
         }
-        interrupts_set(enabled);
+        sched_unlock(enabled);
         return count;
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
     return 0;
 }
 
-/* suspend current thread until Thread tid exits */
-Tid
-thread_wait(Tid tid, int *exit_code)
+/* suspend current thread until Thread tid exits, or wheel time expires */
+static Tid
+thread_wait_until(Tid tid, int *exit_code, uint64_t expires)
 {
-    int enabled = interrupts_set(0);
-    if (tid < 0 || tid > THREAD_MAX_THREADS || tid == current_tid || threads[tid].state == NOTVALID || threads[tid].be_killed == 1){
-        interrupts_set(enabled);
+    int enabled = sched_lock();
+    if (tid < 0 || tid >= THREAD_MAX_THREADS || tid == current_tid || threads[tid].state == NOTVALID || threads[tid].be_killed == 1){
+        sched_unlock(enabled);
 		return THREAD_INVALID;
 	}
-    thread_sleep(threads[tid].wait_queue);
+    if (thread_sleep_until(threads[tid].wait_queue, expires)){
+        sched_unlock(enabled);
+        return THREAD_TIMEOUT;
+    }
 	if (threads[current_tid].exit_code != -1){
         if (exit_code != NULL){
             * exit_code = threads[current_tid].exit_code;
         }
         threads[current_tid].exit_code = -1;
-        interrupts_set(enabled);
+        sched_unlock(enabled);
         return tid;
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 	return THREAD_INVALID;
 }
 
+Tid
+thread_wait(Tid tid, int *exit_code)
+{
+    return thread_wait_until(tid, exit_code, WHEEL_NEVER);
+}
+
+Tid
+thread_wait_timeout(Tid tid, int *exit_code, long usecs)
+{
+    if (usecs < 0){
+        return THREAD_INVALID;
+    }
+    return thread_wait_until(tid, exit_code, wheel_deadline(usecs));
+}
+
+/* Locks are handed off in FIFO order: lock_release() gives the lock to the
+ * thread that has waited longest and wakes only that one, so the others
+ * sleep on instead of all waking up to race for it. A thread that finds the
+ * lock held waits until it is the holder. */
 struct lock {
     /* ... Fill this in ... */
     Tid hold_pid;
@@ -470,7 +1725,7 @@ struct lock {
 struct lock *
 lock_create()
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     struct lock *lock;
 
     lock = malloc(sizeof(struct lock));
@@ -479,44 +1734,82 @@ lock_create()
     lock->hold_pid = THREAD_INVALID;
     lock->wq = wait_queue_create();
     assert(lock->wq);
-    interrupts_set(enabled);
+    sched_unlock(enabled);
     return lock;
 }
 
 void
 lock_destroy(struct lock *lock)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     assert(lock != NULL);
-    if (lock->hold_pid == THREAD_INVALID && lock->wq->root == NULL){
+    if (lock->hold_pid == THREAD_INVALID && lock->wq->head == THREAD_NONE){
         wait_queue_destroy(lock->wq);
         free(lock);
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
+}
+
+/* Waits for lock until wheel time expires. Returns 0 once it holds the
+ * lock, or THREAD_TIMEOUT. */
+static int
+lock_acquire_until(struct lock *lock, uint64_t expires)
+{
+    int enabled = sched_lock();
+    assert(lock != NULL);
+    if (lock->hold_pid == THREAD_INVALID){
+        lock->hold_pid = current_tid;
+    }
+    while (lock->hold_pid != current_tid){
+        if (thread_sleep_until(lock->wq, expires)){
+            break;
+        }
+    }
+    threads[current_tid].handoff = NULL;
+    int ret = lock->hold_pid == current_tid ? 0 : THREAD_TIMEOUT;
+    sched_unlock(enabled);
+    return ret;
 }
 
 void
 lock_acquire(struct lock *lock)
 {
-    int enabled = interrupts_set(0);
-    assert(lock != NULL);
-    while (lock->hold_pid != THREAD_INVALID){
-        thread_sleep(lock->wq);
+    lock_acquire_until(lock, WHEEL_NEVER);
+}
+
+int
+lock_acquire_timeout(struct lock *lock, long usecs)
+{
+    if (usecs < 0){
+        return THREAD_INVALID;
+    }
+    return lock_acquire_until(lock, wheel_deadline(usecs));
+}
+
+/* Hands lock to the thread that has waited longest, or frees it if none
+ * waits, with sched_lock() held. */
+static void
+lock_pass(struct lock *lock)
+{
+    Tid next = wakeup_one(lock->wq);
+    if (next == THREAD_NONE){
+        lock->hold_pid = THREAD_INVALID;
+    }
+    else{
+        lock->hold_pid = next;
+        threads[next].handoff = lock;
     }
-    lock->hold_pid = current_tid;
-    interrupts_set(enabled);
 }
 
 void
 lock_release(struct lock *lock)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     assert(lock != NULL);
     if (current_tid == lock->hold_pid){
-        lock->hold_pid = THREAD_INVALID;
-	    thread_wakeup(lock->wq, 1);
+        lock_pass(lock);
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 }
 
 struct cv {
@@ -527,67 +1820,85 @@ struct cv {
 struct cv *
 cv_create()
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     struct cv *cv;
 
     cv = malloc(sizeof(struct cv));
     assert(cv);
 
     cv->wq = wait_queue_create();
-    interrupts_set(enabled);
+    sched_unlock(enabled);
     return cv;
 }
 
 void
 cv_destroy(struct cv *cv)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     assert(cv != NULL);
 
-    if (cv->wq->root == NULL){
+    if (cv->wq->head == THREAD_NONE){
         wait_queue_destroy(cv->wq);
     }
     free(cv);
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 }
 
-void
-cv_wait(struct cv *cv, struct lock *lock)
+/* cv_wait until wheel time expires. Returns 0 if signalled, THREAD_TIMEOUT
+ * if it timed out, and THREAD_INVALID if the caller does not hold lock. */
+static int
+cv_wait_until(struct cv *cv, struct lock *lock, uint64_t expires)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
+    int ret = THREAD_INVALID;
     assert(cv != NULL);
     assert(lock != NULL);
     if (lock->hold_pid == current_tid){
         lock_release(lock);
-        thread_sleep(cv->wq);
-        interrupts_set(enabled);
-		lock_acquire(lock);
+        ret = thread_sleep_until(cv->wq, expires) ? THREAD_TIMEOUT : 0;
+        lock_acquire(lock);
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
+    return ret;
+}
+
+void
+cv_wait(struct cv *cv, struct lock *lock)
+{
+    cv_wait_until(cv, lock, WHEEL_NEVER);
+}
+
+int
+cv_wait_timeout(struct cv *cv, struct lock *lock, long usecs)
+{
+    if (usecs < 0){
+        return THREAD_INVALID;
+    }
+    return cv_wait_until(cv, lock, wheel_deadline(usecs));
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     assert(cv != NULL);
     assert(lock != NULL);
 
     if (lock->hold_pid == current_tid){
         thread_wakeup(cv->wq, 0);
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-    int enabled = interrupts_set(0);
+    int enabled = sched_lock();
     assert(cv != NULL);
     assert(lock != NULL);
 
     if (lock->hold_pid == current_tid){
         thread_wakeup(cv->wq, 1);
     }
-    interrupts_set(enabled);
+    sched_unlock(enabled);
 }
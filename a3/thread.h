@@ -1,9 +1,12 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
+#include <stddef.h>
+
 typedef int Tid;
 #define THREAD_MAX_THREADS 1024
 #define THREAD_MIN_STACK 32768
+#define THREAD_MAX_WORKERS 64
 
 /*
  * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1. The
@@ -19,6 +22,7 @@ enum { THREAD_ANY = -1,
 	THREAD_NOMORE = -5,
 	THREAD_NOMEMORY = -6,
 	THREAD_FAILED = -7,
+	THREAD_TIMEOUT = -8,
         THREAD_KILLED = -9,
 };
 
@@ -35,6 +39,65 @@ thread_ret_ok(Tid ret)
 /* perform any initialization needed by your threading system */
 void thread_init(void);
 
+/* scheduling policies for thread_init_sched():
+ *
+ * THREAD_SCHED_FIFO: one ready queue, every timer tick preempts the running
+ *                    thread. This is the default.
+ * THREAD_SCHED_MLFQ: multi-level feedback queue. Threads that use up their
+ *                    time quantum move to lower priority levels with longer
+ *                    quanta, and all threads are periodically boosted back
+ *                    to the top level.
+ * THREAD_SCHED_FAIR: fair share. The thread that has had the least CPU time,
+ *                    scaled by its weight (see thread_set_weight), runs next.
+ *
+ * thread_init() uses the policy named by the THREAD_SCHED environment
+ * variable ("fifo", "mlfq" or "fair") if it is set. */
+enum { THREAD_SCHED_FIFO,
+	THREAD_SCHED_MLFQ,
+	THREAD_SCHED_FAIR,
+};
+
+#define THREAD_WEIGHT_DEFAULT 1024
+
+/* thread_init with the given scheduling policy */
+void thread_init_sched(int policy);
+
+/* thread_init with n kernel threads (workers), including the caller, running
+ * the user threads. Each worker keeps its own ready threads and runs them
+ * round robin, taking threads from the other workers when it has none, so
+ * that up to n threads run in parallel. A thread may move to another worker
+ * whenever it is switched out. The THREAD_SCHED_* policies do not apply.
+ *
+ * The timer interrupt preempts threads on every worker. A thread preempted
+ * inside a C library call that keeps per-kernel-thread state or takes a
+ * lock, such as malloc or stdio, may resume on another worker or block the
+ * threads that call it next on this one, so disable interrupts around such
+ * calls, as unintr_printf does.
+ *
+ * Another worker may run a new thread, even to completion, before its
+ * creator yields to it, so a directed yield to it may return THREAD_INVALID.
+ * Tests that expect threads to run in a strict order or yield to the threads
+ * they just created, such as test_basic, assume a single worker.
+ *
+ * thread_init() calls this if the THREAD_WORKERS environment variable is set
+ * to more than 1. */
+void thread_init_workers(int n);
+
+/* set the scheduling weight of thread tid (or THREAD_SELF). Under
+ * THREAD_SCHED_FAIR, ready threads get CPU time in proportion to their
+ * weights; other policies ignore it. New threads get THREAD_WEIGHT_DEFAULT.
+ * Returns tid, or THREAD_INVALID if tid is not a valid thread or weight is
+ * not positive. */
+Tid thread_set_weight(Tid tid, int weight);
+
+/* return the number of switches from one thread to another so far, on all
+ * workers, for measuring the scheduler */
+unsigned long thread_switches(void);
+
+/* called by the timer interrupt handler, with interrupts disabled, to let the
+ * scheduling policy preempt the running thread */
+void thread_tick(void);
+
 /* return the thread identifier of the currently running thread */
 Tid thread_id(void);
 
@@ -46,6 +109,11 @@ Tid thread_id(void);
  * THREAD_NOMEMORY: no more memory available to create a thread stack. */
 Tid thread_create(void (*fn) (void *), void *arg);
 
+/* thread_create_stack is thread_create with a stack of stack_size bytes
+ * instead of THREAD_MIN_STACK. Sizes below THREAD_MIN_STACK are rounded up
+ * to it. */
+Tid thread_create_stack(void (*fn) (void *), void *arg, size_t stack_size);
+
 /* thread_yield should suspend the calling thread and run the thread with
  * identifier tid. The calling thread is put in the ready queue. tid can be
  * identifier of any available thread or the following constants:
@@ -127,6 +195,18 @@ int thread_wakeup(struct wait_queue *queue, int all);
  */
 int thread_wait(Tid tid, int *exit_code);
 
+/* Timed waits. Timeouts are in usec, rounded up to the timer resolution
+ * (SIG_INTERVAL), and take effect even when no timer interrupts are
+ * registered. A negative timeout returns THREAD_INVALID. */
+
+/* suspend the calling thread for at least usecs, running other threads
+ * meanwhile. Returns 0. */
+int thread_sleep_for(long usecs);
+
+/* thread_wait, giving up after usecs. Returns THREAD_TIMEOUT if tid has not
+ * exited by then. */
+int thread_wait_timeout(Tid tid, int *exit_code, long usecs);
+
 /* create a blocking lock. initially, the lock is available. associate a wait
  * queue with the lock so that threads that need to acquire the lock can wait in
  * this queue. */
@@ -138,9 +218,13 @@ void lock_destroy(struct lock *lock);
 /* acquire the lock. threads should be suspended until they can acquire the
  * lock. */
 void lock_acquire(struct lock *lock);
+/* lock_acquire, giving up after usecs. Returns 0 once the lock is acquired,
+ * or THREAD_TIMEOUT if it was not acquired in time. */
+int lock_acquire_timeout(struct lock *lock, long usecs);
 /* release the lock. be sure to check that the lock had been acquired by the
- * calling thread, before it is released. wakeup all threads that are waiting to
- * acquire the lock. */
+ * calling thread, before it is released. the lock is handed off in FIFO order
+ * to the thread that has waited longest to acquire it, which alone is woken
+ * up. */
 void lock_release(struct lock *lock);
 
 /* create a condition variable. associate a wait queue with the condition
@@ -154,6 +238,10 @@ void cv_destroy(struct cv *cv);
  * need to release the lock before waiting, and reacquire it before returning
  * from wait. */
 void cv_wait(struct cv *cv, struct lock *lock);
+/* cv_wait, giving up after usecs. The lock is reacquired before returning
+ * either way. Returns 0 if the thread was woken up, THREAD_TIMEOUT if it
+ * timed out, or THREAD_INVALID if the calling thread does not hold lock. */
+int cv_wait_timeout(struct cv *cv, struct lock *lock, long usecs);
 
 /* wake up one thread that is waiting on the condition variable cv. be sure to
  * check that the calling thread had acquired lock when this call is made. */
@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pagetable_generic.h"
+#include "checkpoint.h"
+
+// Width of the per-frame age counter: 8, 16 or 32 bits.
+#ifndef AGE_BITS
+#define AGE_BITS 16
+#endif
+
+#if AGE_BITS == 8
+typedef uint8_t age_t;
+#elif AGE_BITS == 16
+typedef uint16_t age_t;
+#elif AGE_BITS == 32
+typedef uint32_t age_t;
+#else
+#error "AGE_BITS must be 8, 16 or 32"
+#endif
+
+// The counters are updated 32 bytes at a time with GCC vector extensions,
+// which compile to SIMD instructions where the target has them.
+#define AGE_VEC_BYTES 32
+#define AGE_PER_VEC (AGE_VEC_BYTES / sizeof(age_t))
+typedef age_t age_vec __attribute__((vector_size(AGE_VEC_BYTES)));
+
+__thread size_t aging_interval;
+
+static __thread age_t *ages;     // shift register of reference history
+static __thread age_t *refd;     // 1 if referenced since the last tick
+static __thread uint8_t *taken;  // chosen as a victim in the current batch
+static __thread size_t nvecs;
+static __thread size_t next_tick;
+
+// Min summary: a complete binary tree over the frames in which every node
+// holds the frame with the smallest age in its subtree (ties go to the lower
+// frame number). Leaves past memsize hold memsize, which is never chosen.
+static __thread int *tree;
+static __thread size_t leaves;
+
+static inline uint64_t age_key(int frame)
+{
+	if ((size_t)frame >= memsize) {
+		return UINT64_MAX;
+	}
+	if (taken[frame]) {
+		return UINT64_MAX - 1;
+	}
+	return ages[frame];
+}
+
+static inline int min_frame(int a, int b)
+{
+	uint64_t ka = age_key(a);
+	uint64_t kb = age_key(b);
+	if (ka != kb) {
+		return ka < kb ? a : b;
+	}
+	return a < b ? a : b;
+}
+
+static void tree_rebuild(void)
+{
+	for (size_t i = leaves - 1; i > 0; i--) {
+		tree[i] = min_frame(tree[2 * i], tree[2 * i + 1]);
+	}
+}
+
+static void tree_update(int frame)
+{
+	for (size_t i = (leaves + frame) / 2; i > 0; i /= 2) {
+		tree[i] = min_frame(tree[2 * i], tree[2 * i + 1]);
+	}
+}
+
+/* Shifts every age counter right by one, moving the reference bits gathered
+ * since the last tick into the high bits, and clears the reference bits.
+ */
+static void aging_tick(void)
+{
+	age_vec *a = (age_vec *)ages;
+	age_vec *r = (age_vec *)refd;
+	const age_vec zero = { 0 };
+
+	for (size_t i = 0; i < nvecs; i++) {
+		a[i] = (a[i] >> 1) | (r[i] << (AGE_BITS - 1));
+		r[i] = zero;
+	}
+	tree_rebuild();
+}
+
+/* Takes the frame with the smallest age out of consideration for the rest of
+ * the batch and returns it.
+ */
+static int aging_take(void)
+{
+	int frame = tree[1];
+	assert((size_t)frame < memsize && !taken[frame]);
+	taken[frame] = 1;
+	tree_update(frame);
+	return frame;
+}
+
+/* The page brought into a victim frame counts as referenced in the current
+ * interval, so it is not the first choice for the next eviction.
+ */
+static void aging_reset(int frame)
+{
+	taken[frame] = 0;
+	ages[frame] = (age_t)1 << (AGE_BITS - 1);
+	refd[frame] = 0;
+	tree_update(frame);
+}
+
+/* Page to evict is chosen using the Aging algorithm: the frame whose age
+ * counter is smallest, found through the min summary rather than a scan.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int aging_evict(void)
+{
+	int frame = aging_take();
+	aging_reset(frame);
+	return frame;
+}
+
+/* Takes the n frames with the smallest ages.
+ * Returns the number of victims stored in frames.
+ */
+size_t aging_evict_batch(int *frames, size_t n)
+{
+	size_t count = 0;
+	for (; count < n && count < memsize; count++) {
+		frames[count] = aging_take();
+	}
+	for (size_t i = 0; i < count; i++) {
+		aging_reset(frames[i]);
+	}
+	return count;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the Aging algorithm. Only a dense reference bit is set here;
+ * the counters are updated every aging_interval references.
+ */
+void aging_ref(int frame)
+{
+	refd[frame] = 1;
+	if (ref_count >= next_tick) {
+		next_tick = ref_count + aging_interval;
+		aging_tick();
+	}
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void aging_init(void)
+{
+	nvecs = (memsize + AGE_PER_VEC - 1) / AGE_PER_VEC;
+	ages = aligned_alloc(AGE_VEC_BYTES, nvecs * AGE_VEC_BYTES);
+	refd = aligned_alloc(AGE_VEC_BYTES, nvecs * AGE_VEC_BYTES);
+	taken = calloc(memsize, sizeof(uint8_t));
+	memset(ages, 0, nvecs * AGE_VEC_BYTES);
+	memset(refd, 0, nvecs * AGE_VEC_BYTES);
+
+	leaves = 1;
+	while (leaves < memsize) {
+		leaves *= 2;
+	}
+	tree = malloc(2 * leaves * sizeof(int));
+	for (size_t i = 0; i < leaves; i++) {
+		tree[leaves + i] = i < memsize ? (int)i : (int)memsize;
+	}
+	tree_rebuild();
+	next_tick = aging_interval;
+}
+
+/* Cleanup any data structures created in aging_init(). */
+void aging_cleanup(void)
+{
+	free(ages);
+	free(refd);
+	free(taken);
+	free(tree);
+}
+
+/* Save the age counters and reference flags to a checkpoint. */
+int aging_checkpoint(FILE *f)
+{
+	return ckpt_put(f, ages, nvecs * AGE_VEC_BYTES) |
+	       ckpt_put(f, refd, nvecs * AGE_VEC_BYTES) |
+	       ckpt_put(f, &next_tick, sizeof(next_tick));
+}
+
+/* Restore the state saved by aging_checkpoint(). */
+int aging_restore(FILE *f)
+{
+	if (ckpt_get(f, ages, nvecs * AGE_VEC_BYTES) != 0 ||
+	    ckpt_get(f, refd, nvecs * AGE_VEC_BYTES) != 0 ||
+	    ckpt_get(f, &next_tick, sizeof(next_tick)) != 0) {
+		return -1;
+	}
+	tree_rebuild();
+	return 0;
+}
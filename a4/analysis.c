@@ -0,0 +1,229 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+
+//---------------------------------------------------------------------
+// Reuse distance, measured as the number of references since the previous
+// reference to the same page, kept in log2 buckets. The time of the last
+// reference to each page is kept in a direct-mapped table; a page whose
+// slot has since been taken over by another page is counted as untracked
+// rather than given a wrong distance.
+
+#define REUSE_BUCKETS 64
+#define REUSE_TABLE_BITS 16
+#define REUSE_TABLE_SIZE ((size_t)1 << REUSE_TABLE_BITS)
+
+struct reuse_slot {
+	vaddr_t vpn;
+	size_t last_ref;  // 0 if the slot is empty
+};
+
+static struct reuse_slot *reuse_table;
+static size_t reuse_hist[REUSE_BUCKETS];
+static size_t reuse_first;
+static size_t reuse_untracked;
+static size_t analysis_time;
+
+// Multiplicative hashing; the constants are odd and otherwise arbitrary.
+static const uint64_t hash_seeds[] = {
+	0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+};
+
+static inline size_t hash_vpn(vaddr_t vpn, int row, int bits)
+{
+	return (size_t)((vpn * hash_seeds[row]) >> (64 - bits));
+}
+
+static inline int log2_bucket(size_t n)
+{
+	assert(n > 0);
+	return 63 - __builtin_clzll(n);
+}
+
+static void reuse_ref(vaddr_t vpn)
+{
+	struct reuse_slot *slot = &reuse_table[hash_vpn(vpn, 0, REUSE_TABLE_BITS)];
+
+	if (slot->last_ref != 0 && slot->vpn == vpn) {
+		reuse_hist[log2_bucket(analysis_time - slot->last_ref)] += 1;
+	} else if (slot->last_ref == 0) {
+		reuse_first += 1;
+	} else {
+		reuse_untracked += 1;
+	}
+	slot->vpn = vpn;
+	slot->last_ref = analysis_time;
+}
+
+//---------------------------------------------------------------------
+// Per-page reference counts, estimated with count-min sketches (one for reads
+// and one for writes), plus the top_n pages with the highest estimates seen
+// so far.
+
+#define CMS_DEPTH 4
+#define CMS_WIDTH_BITS 12
+#define CMS_WIDTH ((size_t)1 << CMS_WIDTH_BITS)
+#define MAX_TOP_N 256
+
+struct sketch {
+	uint32_t counts[CMS_DEPTH][CMS_WIDTH];
+};
+
+struct top_page {
+	vaddr_t vpn;
+	uint32_t estimate;
+};
+
+static struct sketch *reads;
+static struct sketch *writes;
+static struct top_page *top;
+static size_t top_n;
+static size_t top_count;
+
+static void sketch_add(struct sketch *s, vaddr_t vpn)
+{
+	for (int row = 0; row < CMS_DEPTH; row++) {
+		uint32_t *c = &s->counts[row][hash_vpn(vpn, row, CMS_WIDTH_BITS)];
+		if (*c != UINT32_MAX) {
+			*c += 1;
+		}
+	}
+}
+
+static uint32_t sketch_estimate(const struct sketch *s, vaddr_t vpn)
+{
+	uint32_t min = UINT32_MAX;
+	for (int row = 0; row < CMS_DEPTH; row++) {
+		uint32_t c = s->counts[row][hash_vpn(vpn, row, CMS_WIDTH_BITS)];
+		if (c < min) {
+			min = c;
+		}
+	}
+	return min;
+}
+
+static void top_update(vaddr_t vpn, uint32_t estimate)
+{
+	size_t min_idx = 0;
+
+	for (size_t i = 0; i < top_count; i++) {
+		if (top[i].vpn == vpn) {
+			top[i].estimate = estimate;
+			return;
+		}
+		if (top[i].estimate < top[min_idx].estimate) {
+			min_idx = i;
+		}
+	}
+	if (top_count < top_n) {
+		top[top_count].vpn = vpn;
+		top[top_count].estimate = estimate;
+		top_count += 1;
+	} else if (top_n > 0 && estimate > top[min_idx].estimate) {
+		top[min_idx].vpn = vpn;
+		top[min_idx].estimate = estimate;
+	}
+}
+
+static int top_cmp(const void *a, const void *b)
+{
+	const struct top_page *pa = a;
+	const struct top_page *pb = b;
+	if (pa->estimate != pb->estimate) {
+		return pa->estimate < pb->estimate ? 1 : -1;
+	}
+	return pa->vpn < pb->vpn ? -1 : (pa->vpn > pb->vpn);
+}
+
+//---------------------------------------------------------------------
+
+void analysis_init(size_t n)
+{
+	top_n = n < MAX_TOP_N ? n : MAX_TOP_N;
+	top_count = 0;
+	top = calloc(top_n ? top_n : 1, sizeof(struct top_page));
+	reads = calloc(1, sizeof(struct sketch));
+	writes = calloc(1, sizeof(struct sketch));
+	reuse_table = calloc(REUSE_TABLE_SIZE, sizeof(struct reuse_slot));
+	if (!top || !reads || !writes || !reuse_table) {
+		perror("Failed to allocate analysis tables");
+		exit(1);
+	}
+	memset(reuse_hist, 0, sizeof(reuse_hist));
+	reuse_first = reuse_untracked = 0;
+	analysis_time = 0;
+}
+
+/* Called on each reference in the trace. Modify references are counted as
+ * both a read and a write. */
+void analysis_ref(vaddr_t vaddr, char type)
+{
+	vaddr_t vpn = vaddr >> PAGE_SHIFT;
+
+	analysis_time += 1;
+	reuse_ref(vpn);
+
+	if (type != 'S') {
+		sketch_add(reads, vpn);
+	}
+	if (type == 'S' || type == 'M') {
+		sketch_add(writes, vpn);
+	}
+	top_update(vpn, sketch_estimate(reads, vpn) + sketch_estimate(writes, vpn));
+}
+
+void analysis_print(void)
+{
+	const int bar_width = 40;
+	size_t max = 0;
+
+	printf("\nReuse distance (references since last use of the page):\n");
+	for (int b = 0; b < REUSE_BUCKETS; b++) {
+		if (reuse_hist[b] > max) {
+			max = reuse_hist[b];
+		}
+	}
+	for (int b = 0; b < REUSE_BUCKETS; b++) {
+		if (reuse_hist[b] == 0) {
+			continue;
+		}
+		int len = (int)((double)reuse_hist[b] / max * bar_width + 0.5);
+		printf("  [2^%-2d, 2^%-2d) %12zu  %.*s\n", b, b + 1, reuse_hist[b],
+		       len, "########################################");
+	}
+	printf("  first use     %12zu\n", reuse_first);
+	printf("  untracked     %12zu\n", reuse_untracked);
+
+	if (top_count == 0) {
+		return;
+	}
+	qsort(top, top_count, sizeof(struct top_page), top_cmp);
+	printf("\nTop %zu pages by reference count (count-min estimates):\n", top_count);
+	printf("  %-14s %10s %10s %10s %8s\n", "page", "refs", "reads", "writes", "r/w");
+	for (size_t i = 0; i < top_count; i++) {
+		uint32_t r = sketch_estimate(reads, top[i].vpn);
+		uint32_t w = sketch_estimate(writes, top[i].vpn);
+		int len = (int)((double)top[i].estimate / top[0].estimate * bar_width + 0.5);
+		printf("  0x%012lx %10u %10u %10u ", top[i].vpn << PAGE_SHIFT,
+		       top[i].estimate, r, w);
+		if (w > 0) {
+			printf("%8.2f", (double)r / w);
+		} else {
+			printf("%8s", "-");
+		}
+		printf("  %.*s\n", len, "########################################");
+	}
+}
+
+void analysis_destroy(void)
+{
+	free(top);
+	free(reads);
+	free(writes);
+	free(reuse_table);
+}
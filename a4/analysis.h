@@ -0,0 +1,17 @@
+#ifndef __ANALYSIS_H__
+#define __ANALYSIS_H__
+
+#include <stddef.h>
+#include "pagetable_generic.h"
+
+
+// Workload analysis collected alongside the simulation, using a fixed amount
+// of memory regardless of trace length or footprint.
+
+void analysis_init(size_t top_n);
+void analysis_ref(vaddr_t vaddr, char type);
+void analysis_print(void);
+void analysis_destroy(void);
+
+
+#endif /* __ANALYSIS_H__ */
@@ -0,0 +1,305 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+//---------------------------------------------------------------------
+// Batch mode runs a list of jobs, each a (trace, algorithm, memsize,
+// swapsize) combination, on a fixed pool of worker threads and writes one
+// CSV row per job. The jobs come either from a manifest file with one job
+// per line:
+//
+//     # trace  algorithm  memsize  [swapsize]
+//     traces/simpleloop.ref  lru  50  3000
+//
+// or from a directory, in which case every regular file in it is run with
+// each algorithm in the comma-separated -a list and the -m and -s values.
+//
+// Simulator state is thread-local, so a worker just calls run_sim() for
+// each job it takes. Workers take jobs in order from a shared counter;
+// results are stored per job and written out in job order at the end, so
+// the CSV does not depend on scheduling.
+
+struct batch_job {
+	struct sim_job job;
+	struct sim_result res;
+	int status;
+};
+
+struct batch {
+	struct batch_job *jobs;
+	size_t njobs;
+	size_t capacity;
+	size_t next;         // index of the next job to hand out
+	char **strings;      // trace names and algorithm names owned by the batch
+	size_t nstrings;
+};
+
+static char *batch_strdup(struct batch *b, const char *s)
+{
+	char *copy = strdup(s);
+	char **strings = realloc(b->strings, (b->nstrings + 1) * sizeof(char *));
+	if (!copy || !strings) {
+		perror("batch");
+		exit(1);
+	}
+	b->strings = strings;
+	b->strings[b->nstrings++] = copy;
+	return copy;
+}
+
+static void batch_add(struct batch *b, const struct sim_job *defaults,
+                      const char *trace, const char *alg,
+                      size_t memsize, size_t swapsize)
+{
+	if (b->njobs == b->capacity) {
+		b->capacity = b->capacity ? b->capacity * 2 : 64;
+		b->jobs = realloc(b->jobs, b->capacity * sizeof(struct batch_job));
+		if (!b->jobs) {
+			perror("batch");
+			exit(1);
+		}
+	}
+	struct batch_job *bj = &b->jobs[b->njobs++];
+	memset(bj, 0, sizeof(*bj));
+	bj->job = *defaults;
+	bj->job.tracefile = batch_strdup(b, trace);
+	bj->job.alg = batch_strdup(b, alg);
+	bj->job.memsize = memsize;
+	bj->job.swapsize = swapsize;
+	bj->job.measure_memory = false;
+	bj->job.report = false;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Adds every regular file in dir, run with each algorithm in defaults->alg.
+ * Returns 0 on success and -1 on error. */
+static int load_dir(struct batch *b, const char *dir, const struct sim_job *defaults)
+{
+	if (!defaults->alg || !defaults->memsize) {
+		fprintf(stderr, "Error: a trace directory needs -a and -m\n");
+		return -1;
+	}
+
+	DIR *d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return -1;
+	}
+
+	char **names = NULL;
+	size_t nnames = 0;
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		char path[PATH_MAX];
+		struct stat st;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		names = realloc(names, (nnames + 1) * sizeof(char *));
+		names[nnames++] = batch_strdup(b, path);
+	}
+	closedir(d);
+
+	// Sort so that the job order (and the CSV) is repeatable
+	qsort(names, nnames, sizeof(char *), cmp_names);
+
+	char *algs = batch_strdup(b, defaults->alg);
+	for (size_t i = 0; i < nnames; i++) {
+		char *save = NULL;
+		char list[strlen(algs) + 1];
+		strcpy(list, algs);
+		for (char *alg = strtok_r(list, ",", &save); alg;
+		     alg = strtok_r(NULL, ",", &save)) {
+			batch_add(b, defaults, names[i], alg,
+			          defaults->memsize, defaults->swapsize);
+		}
+	}
+	free(names);
+	return 0;
+}
+
+/* Adds one job per line of the manifest. Blank lines and lines starting with
+ * '#' are ignored. Returns 0 on success and -1 on error. */
+static int load_manifest(struct batch *b, const char *manifest, const struct sim_job *defaults)
+{
+	FILE *f = fopen(manifest, "r");
+	if (!f) {
+		perror(manifest);
+		return -1;
+	}
+
+	char line[PATH_MAX + 128];
+	size_t linenum = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char trace[PATH_MAX];
+		char alg[64];
+		size_t memsize, swapsize = 0;
+		char first;
+
+		++linenum;
+		if (sscanf(line, " %c", &first) != 1 || first == '#') {
+			continue;
+		}
+		if (sscanf(line, "%4095s %63s %zu %zu", trace, alg, &memsize, &swapsize) < 3 ||
+		    memsize == 0) {
+			fprintf(stderr, "%s: invalid job on line %zu: %s",
+			        manifest, linenum, line);
+			fclose(f);
+			return -1;
+		}
+		batch_add(b, defaults, trace, alg, memsize, swapsize);
+	}
+	fclose(f);
+	return 0;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch *b = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->njobs) {
+		b->jobs[i].status = run_sim(&b->jobs[i].job, &b->jobs[i].res);
+	}
+	return NULL;
+}
+
+/* Writes s as a CSV field, quoted if it needs to be. */
+static void csv_string(FILE *out, const char *s)
+{
+	if (strpbrk(s, ",\"\n") == NULL) {
+		fputs(s, out);
+		return;
+	}
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"') {
+			fputc('"', out);
+		}
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void write_csv(FILE *out, const struct batch *b)
+{
+	fprintf(out, "trace,algorithm,memsize,swapsize,status,references,hits,misses,"
+	        "hit_rate,clean_evictions,dirty_evictions,minor_faults,major_faults,"
+	        "swap_write_ops,stall_ms,amat_ns,time_s\n");
+	for (size_t i = 0; i < b->njobs; i++) {
+		const struct batch_job *bj = &b->jobs[i];
+		const struct sim_result *r = &bj->res;
+
+		csv_string(out, bj->job.tracefile);
+		fputc(',', out);
+		csv_string(out, bj->job.alg);
+		fprintf(out, ",%zu,%zu,%s,%zu,%zu,%zu,%.4f,%zu,%zu,%zu,%zu,%zu,%.3f,%.2f,%f\n",
+		        bj->job.memsize, bj->job.swapsize,
+		        bj->status == 0 ? "ok" : "failed",
+		        r->ref_count, r->hit_count, r->miss_count,
+		        r->ref_count ? (double)r->hit_count / r->ref_count * 100.0 : 0.0,
+		        r->evict_clean_count, r->evict_dirty_count,
+		        r->minor_fault_count, r->major_fault_count,
+		        r->swap_write_count, r->stall_ns / 1000000.0, r->amat_ns,
+		        r->time);
+	}
+}
+
+/* Runs every job described by path (a directory of traces or a manifest) on
+ * nworkers threads, or one per online CPU if nworkers is 0, and writes the
+ * results to csvfile, or stdout if it is NULL.
+ * Returns 0 if every job succeeded and -1 otherwise.
+ */
+int run_batch(const char *path, const struct sim_job *defaults,
+              size_t nworkers, const char *csvfile)
+{
+	struct batch b;
+	struct stat st;
+	int ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		ret = load_dir(&b, path, defaults);
+	} else {
+		ret = load_manifest(&b, path, defaults);
+	}
+	if (ret != 0) {
+		goto out;
+	}
+
+	if (nworkers == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = ncpus > 0 ? (size_t)ncpus : 1;
+	}
+	if (nworkers > b.njobs) {
+		nworkers = b.njobs ? b.njobs : 1;
+	}
+
+	pthread_t *workers = malloc(nworkers * sizeof(pthread_t));
+	size_t started = 0;
+	for (; workers && started < nworkers; started++) {
+		int err = pthread_create(&workers[started], NULL, batch_worker, &b);
+		if (err != 0) {
+			fprintf(stderr, "batch: could not start worker: %s\n", strerror(err));
+			break;
+		}
+	}
+	if (started == 0) {
+		// Run everything on this thread instead
+		batch_worker(&b);
+	}
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	FILE *out = csvfile ? fopen(csvfile, "w") : stdout;
+	if (!out) {
+		perror(csvfile);
+		ret = -1;
+		goto out;
+	}
+	write_csv(out, &b);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	size_t failed = 0;
+	for (size_t i = 0; i < b.njobs; i++) {
+		failed += b.jobs[i].status != 0;
+	}
+	fprintf(stderr, "Ran %zu jobs on %zu workers, %zu failed\n",
+	        b.njobs, started ? started : 1, failed);
+	if (failed) {
+		ret = -1;
+	}
+
+out:
+	for (size_t i = 0; i < b.nstrings; i++) {
+		free(b.strings[i]);
+	}
+	free(b.strings);
+	free(b.jobs);
+	return ret;
+}
@@ -0,0 +1,14 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stddef.h>
+#include "sim.h"
+
+
+// Batch mode: run many simulations on a pool of worker threads
+
+int run_batch(const char *path, const struct sim_job *defaults,
+              size_t nworkers, const char *csvfile);
+
+
+#endif /* __BATCH_H__ */
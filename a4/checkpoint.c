@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+//---------------------------------------------------------------------
+// A checkpoint file holds a header identifying the run and the position in
+// the trace, followed by the page table part (counters, page table entries,
+// coremap, free frames and physical memory), the swap part (bitmap and swap
+// file contents) and the replacement algorithm's own state, in that order.
+//
+// Everything is written through one large stdio buffer so that the bulk of
+// the file (physical memory and swap) goes out in a few large writes. The
+// file is written under a temporary name and renamed into place, so a crash
+// while checkpointing leaves the previous checkpoint intact.
+
+#define CKPT_MAGIC "SIMCKPT"
+#define CKPT_VERSION 4
+#define CKPT_BUFSIZE (1 << 20)
+
+struct ckpt_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t simpagesize;
+	char alg[256];
+	uint64_t memsize;
+	uint64_t swapsize;
+	uint64_t evict_batch;
+	uint64_t ws_tau;
+	uint64_t aging_interval;
+	int64_t trace_pos;   // byte offset of the next line in the trace
+	uint64_t linenum;    // trace lines consumed so far
+};
+
+static void fill_header(struct ckpt_header *h, const struct sim_job *job)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+	h->version = CKPT_VERSION;
+	h->simpagesize = simpagesize;
+	strncpy(h->alg, job->alg, sizeof(h->alg) - 1);
+	h->memsize = job->memsize;
+	h->swapsize = job->swapsize;
+	h->evict_batch = job->evict_batch;
+	h->ws_tau = job->ws_tau;
+	h->aging_interval = job->aging_interval;
+}
+
+/* Writes a checkpoint of the running simulation to path.
+ * Returns 0 on success and -1 on error.
+ */
+int checkpoint_save(const char *path, const struct sim_job *job,
+                    long trace_pos, size_t linenum)
+{
+	char tmp[strlen(path) + 5];
+	struct ckpt_header h;
+	int ret = 0;
+
+	if (!checkpoint_func) {
+		fprintf(stderr, "checkpoint: algorithm %s does not support checkpoints\n",
+		        job->alg);
+		return -1;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, CKPT_BUFSIZE);
+
+	fill_header(&h, job);
+	h.trace_pos = trace_pos;
+	h.linenum = linenum;
+	if (ckpt_put(f, &h, sizeof(h)) != 0 || pagetable_checkpoint(f) != 0 ||
+	    swap_checkpoint(f) != 0 || checkpoint_func(f) != 0) {
+		ret = -1;
+	}
+
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+		ret = -1;
+	}
+	if (fclose(f) != 0) {
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) != 0) {
+		ret = -1;
+	}
+	if (ret != 0) {
+		perror("checkpoint: failed to write checkpoint");
+		unlink(tmp);
+	}
+	return ret;
+}
+
+/* Restores the simulation from the checkpoint at path. The page table, swap
+ * and algorithm must already be initialized for the same job.
+ * Returns 0 on success and -1 if the checkpoint is unreadable or was taken
+ * with different parameters.
+ */
+int checkpoint_load(const char *path, const struct sim_job *job,
+                    long *trace_pos, size_t *linenum)
+{
+	struct ckpt_header h;
+	struct ckpt_header expect;
+	int ret = 0;
+
+	if (!restore_func) {
+		fprintf(stderr, "checkpoint: algorithm %s does not support checkpoints\n",
+		        job->alg);
+		return -1;
+	}
+
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, CKPT_BUFSIZE);
+
+	fill_header(&expect, job);
+	if (ckpt_get(f, &h, sizeof(h)) != 0 ||
+	    memcmp(h.magic, expect.magic, sizeof(h.magic)) != 0 ||
+	    h.version != CKPT_VERSION) {
+		fprintf(stderr, "%s: not a simulator checkpoint\n", path);
+		fclose(f);
+		return -1;
+	}
+	// Everything but the trace position must match the job being resumed
+	expect.trace_pos = h.trace_pos;
+	expect.linenum = h.linenum;
+	if (memcmp(&h, &expect, sizeof(h)) != 0) {
+		fprintf(stderr, "%s: checkpoint was taken with a different algorithm, "
+		        "frame size, memory size, swap size or algorithm parameters\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	if (pagetable_restore(f) != 0 || swap_restore(f) != 0 ||
+	    restore_func(f) != 0) {
+		ret = -1;
+	}
+	fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, "%s: checkpoint is truncated or corrupt\n", path);
+		return -1;
+	}
+
+	*trace_pos = h.trace_pos;
+	*linenum = h.linenum;
+	return 0;
+}
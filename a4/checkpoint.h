@@ -0,0 +1,33 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdio.h>
+#include "sim.h"
+
+
+// Checkpoint and resume of a whole simulation. Each part of the simulator
+// writes its own state to the checkpoint file through the helpers below.
+
+int checkpoint_save(const char *path, const struct sim_job *job,
+                    long trace_pos, size_t linenum);
+int checkpoint_load(const char *path, const struct sim_job *job,
+                    long *trace_pos, size_t *linenum);
+
+int pagetable_checkpoint(FILE *f);
+int pagetable_restore(FILE *f);
+int swap_checkpoint(FILE *f);
+int swap_restore(FILE *f);
+
+// Write or read n bytes. Return 0 on success and -1 on error or end of file.
+static inline int ckpt_put(FILE *f, const void *p, size_t n)
+{
+	return fwrite(p, 1, n, f) == n ? 0 : -1;
+}
+
+static inline int ckpt_get(FILE *f, void *p, size_t n)
+{
+	return fread(p, 1, n, f) == n ? 0 : -1;
+}
+
+
+#endif /* __CHECKPOINT_H__ */
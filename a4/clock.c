@@ -1,6 +1,7 @@
 #include "pagetable_generic.h"
+#include "checkpoint.h"
 
-int clock_hand;
+__thread int clock_hand;
 
 /* Page to evict is chosen using the CLOCK algorithm.
  * Returns the page frame number (which is also the index in the coremap)
@@ -17,6 +18,29 @@ int clock_evict(void)
 	return frame;
 }
 
+/* Chooses up to n victims in one sweep of the clock hand. Frames already
+ * taken off the coremap during this sweep are passed over, so the victims
+ * are distinct even if the hand goes around more than once.
+ * Returns the number of victims stored in frames.
+ */
+size_t clock_evict_batch(int *frames, size_t n)
+{
+	size_t count = 0;
+	for (size_t scanned = 0; count < n && scanned < 2 * memsize; scanned++) {
+		struct frame *f = &coremap[clock_hand];
+		if (f->in_use) {
+			if (get_referenced(f->pte) == 1) {
+				set_referenced(f->pte, 0);
+			} else {
+				f->in_use = false;
+				frames[count++] = clock_hand;
+			}
+		}
+		clock_hand = (clock_hand + 1) % memsize;
+	}
+	return count;
+}
+
 /* This function is called on each access to a page to update any information
  * needed by the CLOCK algorithm.
  * Input: The page table entry for the page that is being accessed.
@@ -37,3 +61,100 @@ void clock_cleanup(void)
 {
 
 }
+
+/* Page to evict is chosen using the WSClock algorithm: the clock hand sweeps
+ * as above, but a page is only evicted once it is outside the working set
+ * (not referenced for ws_tau references). Old dirty pages are written back
+ * and passed over so that a clean page can be taken instead. If a whole
+ * sweep finds nothing to evict, the least recently used page seen is taken.
+ * Frames already chosen as victims in the current batch are passed over.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int wsclock_evict(void)
+{
+	int oldest = -1;
+	bool cleaned = false;
+
+	for (size_t scanned = 0; scanned < 2 * memsize; scanned++) {
+		int frame = clock_hand;
+		struct pt_entry_s *pte = coremap[frame].pte;
+
+		clock_hand = (clock_hand + 1) % memsize;
+		if (!coremap[frame].in_use) {
+			// Already taken as a victim in this batch
+			continue;
+		}
+		if (get_referenced(pte) == 1) {
+			set_referenced(pte, 0);
+			continue;
+		}
+		if (ref_count - frame_last_use[frame] >= ws_tau) {
+			if (!is_dirty(pte)) {
+				return frame;
+			}
+			clean_frame(frame);
+			cleaned = true;
+		}
+		if (oldest == -1 || frame_last_use[frame] < frame_last_use[oldest]) {
+			oldest = frame;
+		}
+		// Keep going after one full sweep only to pick up pages we cleaned
+		if (scanned + 1 == memsize && !cleaned && oldest != -1) {
+			return oldest;
+		}
+	}
+	if (oldest == -1) {
+		// Every page was referenced since the last sweep; fall back to CLOCK
+		return clock_evict();
+	}
+	return oldest;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the WSClock algorithm.
+ */
+void wsclock_ref(int frame)
+{
+	set_referenced(coremap[frame].pte, 1);
+	ws_tick();
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void wsclock_init(void)
+{
+	clock_hand = 0;
+	ws_stats_init();
+}
+
+/* Cleanup any data structures created in wsclock_init(). */
+void wsclock_cleanup(void)
+{
+}
+
+/* Save the clock hand to a checkpoint. */
+int clock_checkpoint(FILE *f)
+{
+	return ckpt_put(f, &clock_hand, sizeof(clock_hand));
+}
+
+/* Restore the clock hand saved by clock_checkpoint(). */
+int clock_restore(FILE *f)
+{
+	return ckpt_get(f, &clock_hand, sizeof(clock_hand));
+}
+
+/* Save the clock hand and working set samples to a checkpoint. */
+int wsclock_checkpoint(FILE *f)
+{
+	return clock_checkpoint(f) | ws_stats_checkpoint(f);
+}
+
+/* Restore the state saved by wsclock_checkpoint(). */
+int wsclock_restore(FILE *f)
+{
+	if (clock_restore(f) != 0) {
+		return -1;
+	}
+	return ws_stats_restore(f);
+}
@@ -1,9 +1,10 @@
 #include "pagetable_generic.h"
 #include <stdlib.h>
+#include "checkpoint.h"
 
-struct frame* head;
-struct frame* tail;
-struct frame* list;
+__thread struct frame* head;
+__thread struct frame* tail;
+__thread struct frame* list;
 
 /* Page to evict is chosen using the accurate LRU algorithm.
  * Returns the page frame number (which is also the index in the coremap)
@@ -19,6 +20,27 @@ int lru_evict(void)
 	return temp->frame;
 }
 
+/* Takes up to n victims off the tail of the list, least recently used first.
+ * Returns the number of victims stored in frames.
+ */
+size_t lru_evict_batch(int *frames, size_t n)
+{
+	size_t count = 0;
+	while (count < n && tail != NULL) {
+		struct frame* temp = tail;
+		tail = tail->prev;
+		if (tail != NULL) {
+			tail->next = NULL;
+		} else {
+			head = NULL;
+		}
+		temp->prev = NULL;
+		temp->next = NULL;
+		frames[count++] = temp->frame;
+	}
+	return count;
+}
+
 /* This function is called on each access to a page to update any information
  * needed by the LRU algorithm.
  * Input: The page table entry for the page that is being accessed.
@@ -69,3 +91,53 @@ void lru_cleanup(void)
 {
 	free(list);
 }
+
+static int frame_index(struct frame *f)
+{
+	return f ? f->frame : -1;
+}
+
+static struct frame *frame_at(int index)
+{
+	return index >= 0 ? &list[index] : NULL;
+}
+
+/* Save the recency list to a checkpoint, with frame numbers in place of
+ * pointers. */
+int lru_checkpoint(FILE *f)
+{
+	int ret = 0;
+	int h = frame_index(head);
+	int t = frame_index(tail);
+
+	ret |= ckpt_put(f, &h, sizeof(h));
+	ret |= ckpt_put(f, &t, sizeof(t));
+	for (size_t i = 0; i < memsize; i++) {
+		int links[2] = { frame_index(list[i].prev), frame_index(list[i].next) };
+		ret |= ckpt_put(f, links, sizeof(links));
+	}
+	return ret;
+}
+
+/* Restore the recency list saved by lru_checkpoint(). */
+int lru_restore(FILE *f)
+{
+	int h, t;
+
+	if (ckpt_get(f, &h, sizeof(h)) != 0 || ckpt_get(f, &t, sizeof(t)) != 0 ||
+	    h >= (int)memsize || t >= (int)memsize) {
+		return -1;
+	}
+	head = frame_at(h);
+	tail = frame_at(t);
+	for (size_t i = 0; i < memsize; i++) {
+		int links[2];
+		if (ckpt_get(f, links, sizeof(links)) != 0 ||
+		    links[0] >= (int)memsize || links[1] >= (int)memsize) {
+			return -1;
+		}
+		list[i].prev = frame_at(links[0]);
+		list[i].next = frame_at(links[1]);
+	}
+	return 0;
+}
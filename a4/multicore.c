@@ -0,0 +1,487 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pagetable_generic.h"
+#include "pagetable.h"
+#include "multicore.h"
+#include "trace.h"
+
+//---------------------------------------------------------------------
+// Multi-core mode replays one trace per simulated CPU, each on its own
+// thread, against a single page table, coremap and physmem.
+//
+// The thread that calls mc_replay() plays the kernel. It owns the simulator
+// state (all of which is thread-local) and is the only thread that runs the
+// replacement algorithm, allocates frames or touches swap. The CPU threads
+// play the hardware. Each one has a small direct-mapped TLB; on a TLB miss
+// it walks the shared page table with atomic loads and sets REF and DIRTY in
+// the entry with compare-and-swap, as an x86 MMU does. A reference that
+// needs the kernel, a page fault or a full reference log, traps: the CPU
+// posts the request and sleeps until the kernel has handled it.
+//
+// The replacement algorithm still sees every reference. CPUs log the pages
+// they touch in a per-CPU ring, which the kernel drains into ref_func()
+// before it handles each trap, so references from different CPUs reach the
+// algorithm slightly out of order.
+//
+// When the kernel unmaps a page, every other CPU that may have cached the
+// translation (the frame's CPU mask) gets a TLB shootdown: the kernel posts
+// an IPI and waits for the CPU to drop the entry at its next reference
+// before reusing the frame. CPUs that are trapped or finished are not
+// running, so the kernel drops their entries itself.
+//
+// Each trace writes its own values, so the contents of memory are not
+// checked against the traces in this mode.
+
+#define TLB_SIZE 64         // entries per CPU, indexed by virtual page number
+#define REFLOG_SIZE 4096    // references a CPU can log between drains
+
+// A TLB entry packs the virtual page number, frame and flags into one word
+#define TLB_VALID 0x1
+#define TLB_DIRTY 0x2
+#define TLB_FRAME_SHIFT 2
+#define TLB_FRAME_BITS 26
+#define TLB_VPN_SHIFT (TLB_FRAME_SHIFT + TLB_FRAME_BITS)
+
+enum cpu_state { CPU_RUNNING, CPU_TRAPPED, CPU_DONE };
+enum trap_kind { TRAP_NONE, TRAP_FAULT, TRAP_DRAIN };
+enum ipi_state { IPI_IDLE, IPI_POSTED, IPI_TAKEN };
+
+struct ref_rec {
+	int frame;
+	vaddr_t vpn;
+};
+
+struct cpu {
+	int id;
+	struct trace_reader *trace;
+	pthread_t thread;
+
+	// Only the CPU itself touches its TLB while it is running
+	uint64_t tlb[TLB_SIZE];
+
+	struct ref_rec reflog[REFLOG_SIZE];
+	size_t log_head;      // next record for the kernel, advanced by the kernel
+	size_t log_tail;      // next free record, advanced by the CPU
+
+	int state;            // enum cpu_state, changed with the lock held
+	int trap;             // enum trap_kind, protected by the lock
+	vaddr_t trap_vaddr;
+	char trap_type;
+	pthread_cond_t wake;
+
+	int ipi;              // enum ipi_state
+	vaddr_t ipi_vpn;
+	int ipi_frame;
+
+	bool failed;
+
+	// Statistics, written by the CPU only
+	size_t refs;
+	size_t tlb_hits;
+	size_t faults;
+	size_t drains;
+	size_t ipis;
+	double trap_time;
+} __attribute__((aligned(64)));
+
+static struct cpu *cpus;
+static size_t ncpus;
+static pd_entry_t *root;
+static unsigned char *mem;
+static uint64_t *frame_cpus;    // CPUs that may cache each frame's translation
+static vaddr_t *frame_vpn;      // page each frame was last mapped for
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kernel_wake = PTHREAD_COND_INITIALIZER;
+static size_t live;             // CPUs that have not finished their trace
+static struct cpu *serving;     // CPU whose trap the kernel is handling
+
+static size_t shootdowns;
+static size_t local_flushes;
+
+static double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t tlb_pack(vaddr_t vpn, int frame, bool dirty)
+{
+	return (uint64_t)vpn << TLB_VPN_SHIFT |
+	       (uint64_t)frame << TLB_FRAME_SHIFT |
+	       (dirty ? TLB_DIRTY : 0) | TLB_VALID;
+}
+
+static int tlb_frame(uint64_t e)
+{
+	return (e >> TLB_FRAME_SHIFT) & ((1u << TLB_FRAME_BITS) - 1);
+}
+
+/* Drops c's translation of vpn to frame, if it has one. */
+static void tlb_drop(struct cpu *c, vaddr_t vpn, int frame)
+{
+	uint64_t *e = &c->tlb[vpn % TLB_SIZE];
+	if ((*e & TLB_VALID) && (*e >> TLB_VPN_SHIFT) == vpn && tlb_frame(*e) == frame) {
+		*e = 0;
+	}
+}
+
+//---------------------------------------------------------------------
+// The kernel side.
+
+/*
+ * Shoots down the translations other CPUs may hold for the page that was
+ * just unmapped from frame. Installed as shootdown_func, so it runs on the
+ * kernel thread right after the page table entry has been changed.
+ */
+static void mc_shootdown(int frame)
+{
+	uint64_t mask = __atomic_exchange_n(&frame_cpus[frame], 0, __ATOMIC_SEQ_CST);
+	vaddr_t vpn = frame_vpn[frame];
+
+	for (size_t i = 0; i < ncpus && mask; i++) {
+		struct cpu *c = &cpus[i];
+		if (!(mask & ((uint64_t)1 << i))) {
+			continue;
+		}
+		mask &= ~((uint64_t)1 << i);
+		if (c == serving) {
+			// The faulting CPU flushes its own TLB
+			tlb_drop(c, vpn, frame);
+			local_flushes += 1;
+			continue;
+		}
+
+		shootdowns += 1;
+		c->ipi_vpn = vpn;
+		c->ipi_frame = frame;
+		__atomic_store_n(&c->ipi, IPI_POSTED, __ATOMIC_SEQ_CST);
+		for (;;) {
+			int ipi = __atomic_load_n(&c->ipi, __ATOMIC_ACQUIRE);
+			if (ipi == IPI_IDLE) {
+				break;
+			}
+			// A CPU that is trapped or done only leaves that state when the
+			// kernel lets it, so its TLB can be changed from here
+			if (ipi == IPI_POSTED &&
+			    __atomic_load_n(&c->state, __ATOMIC_SEQ_CST) != CPU_RUNNING &&
+			    __atomic_compare_exchange_n(&c->ipi, &ipi, IPI_TAKEN, false,
+			                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				tlb_drop(c, vpn, frame);
+				__atomic_store_n(&c->ipi, IPI_IDLE, __ATOMIC_RELEASE);
+				break;
+			}
+			sched_yield();
+		}
+	}
+}
+
+/* Passes the references logged by every CPU to the replacement algorithm,
+ * skipping pages that have been evicted since. */
+static void drain_reflogs(void)
+{
+	for (size_t i = 0; i < ncpus; i++) {
+		struct cpu *c = &cpus[i];
+		size_t tail = __atomic_load_n(&c->log_tail, __ATOMIC_ACQUIRE);
+
+		for (size_t pos = c->log_head; pos != tail; pos++) {
+			struct ref_rec *r = &c->reflog[pos % REFLOG_SIZE];
+			if (coremap[r->frame].in_use && frame_vpn[r->frame] == r->vpn &&
+			    is_valid(coremap[r->frame].pte)) {
+				ref_count += 1;
+				frame_last_use[r->frame] = ref_count;
+				ref_func(r->frame);
+			}
+		}
+		__atomic_store_n(&c->log_head, tail, __ATOMIC_RELEASE);
+	}
+}
+
+/* Returns a CPU waiting in a trap, taking them in turn, or NULL if there is
+ * none. Called with the lock held. */
+static struct cpu *next_trap(size_t *turn)
+{
+	for (size_t n = 0; n < ncpus; n++) {
+		struct cpu *c = &cpus[(*turn + n) % ncpus];
+		if (c->trap != TRAP_NONE) {
+			*turn = (*turn + n + 1) % ncpus;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+/* Handles traps until every CPU has finished its trace. */
+static void kernel_loop(void)
+{
+	size_t turn = 0;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct cpu *c;
+		while (!(c = next_trap(&turn)) && live > 0) {
+			pthread_cond_wait(&kernel_wake, &lock);
+		}
+		if (!c) {
+			break;
+		}
+		pthread_mutex_unlock(&lock);
+
+		drain_reflogs();
+		if (c->trap == TRAP_FAULT) {
+			vaddr_t vpn = c->trap_vaddr >> PAGE_SHIFT;
+			bool write = (c->trap_type == 'S') || (c->trap_type == 'M');
+
+			serving = c;
+			int frame = fault_physpage(c->trap_vaddr, c->trap_type);
+			serving = NULL;
+
+			// Fill the CPU's TLB, as its retry of the access would
+			frame_vpn[frame] = vpn;
+			__atomic_fetch_or(&frame_cpus[frame], (uint64_t)1 << c->id, __ATOMIC_SEQ_CST);
+			c->tlb[vpn % TLB_SIZE] = tlb_pack(vpn, frame, write);
+		}
+
+		pthread_mutex_lock(&lock);
+		c->trap = TRAP_NONE;
+		__atomic_store_n(&c->state, CPU_RUNNING, __ATOMIC_SEQ_CST);
+		pthread_cond_signal(&c->wake);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+//---------------------------------------------------------------------
+// The CPU side.
+
+/* Drops the translation the kernel asked for, if there is an IPI pending.
+ * Called between references. */
+static void take_ipi(struct cpu *c)
+{
+	int ipi = IPI_POSTED;
+	if (__atomic_load_n(&c->ipi, __ATOMIC_ACQUIRE) == IPI_POSTED &&
+	    __atomic_compare_exchange_n(&c->ipi, &ipi, IPI_TAKEN, false,
+	                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		tlb_drop(c, c->ipi_vpn, c->ipi_frame);
+		c->ipis += 1;
+		__atomic_store_n(&c->ipi, IPI_IDLE, __ATOMIC_RELEASE);
+	}
+}
+
+/* Traps into the kernel and sleeps until it has handled the trap. */
+static void trap(struct cpu *c, int kind, vaddr_t vaddr, char type)
+{
+	double start = wall_time();
+
+	pthread_mutex_lock(&lock);
+	c->trap = kind;
+	c->trap_vaddr = vaddr;
+	c->trap_type = type;
+	__atomic_store_n(&c->state, CPU_TRAPPED, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&kernel_wake);
+	while (c->trap != TRAP_NONE) {
+		pthread_cond_wait(&c->wake, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	c->trap_time += wall_time() - start;
+}
+
+/*
+ * Translates vpn through the TLB, or by walking the page table and filling
+ * the TLB. A write through a translation that is not marked dirty walks the
+ * table to set DIRTY in the page table entry.
+ * Returns the frame, or -1 if the page is not resident.
+ */
+static int translate(struct cpu *c, vaddr_t vpn, bool write)
+{
+	uint64_t *e = &c->tlb[vpn % TLB_SIZE];
+	if ((*e & TLB_VALID) && (*e >> TLB_VPN_SHIFT) == vpn &&
+	    (!write || (*e & TLB_DIRTY))) {
+		c->tlb_hits += 1;
+		return tlb_frame(*e);
+	}
+
+	pt_entry_t *pte = lookup_pagetable(root, vpn << PAGE_SHIFT);
+	if (!pte) {
+		return -1;
+	}
+	int flags = REF | (write ? DIRTY : 0);
+	int value = __atomic_load_n(&pte->value, __ATOMIC_ACQUIRE);
+	while (value & VALID) {
+		int frame = value >> PAGE_SHIFT;
+
+		// Announce that this CPU may cache the translation before the CAS
+		// checks that it is still valid. The kernel clears VALID before it
+		// reads the mask, so one of the two sees the other.
+		__atomic_fetch_or(&frame_cpus[frame], (uint64_t)1 << c->id, __ATOMIC_SEQ_CST);
+		if (__atomic_compare_exchange_n(&pte->value, &value, value | flags, false,
+		                                __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+			*e = tlb_pack(vpn, frame, write);
+			return frame;
+		}
+	}
+	return -1;
+}
+
+/* Makes one reference from the trace, trapping to the kernel as needed. */
+static void cpu_ref(struct cpu *c, char type, vaddr_t vaddr, unsigned char val)
+{
+	vaddr_t vpn = vaddr >> PAGE_SHIFT;
+	bool write = (type == 'S') || (type == 'M');
+	bool faulted = false;
+	int frame;
+
+	take_ipi(c);
+	c->refs += 1;
+	// After a fault the kernel has filled the TLB, and any shootdown of that
+	// entry waits until this reference is done
+	while ((frame = translate(c, vpn, write)) < 0) {
+		trap(c, TRAP_FAULT, vaddr, type);
+		faulted = true;
+	}
+	if (faulted) {
+		// The kernel passed this reference to the algorithm itself
+		c->faults += 1;
+	} else {
+		if (c->log_tail - __atomic_load_n(&c->log_head, __ATOMIC_ACQUIRE) == REFLOG_SIZE) {
+			trap(c, TRAP_DRAIN, 0, 0);
+			c->drains += 1;
+		}
+		struct ref_rec *r = &c->reflog[c->log_tail % REFLOG_SIZE];
+		r->frame = frame;
+		r->vpn = vpn;
+		__atomic_store_n(&c->log_tail, c->log_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	// CPUs may store to the same byte at once, as the hardware allows
+	if (write) {
+		__atomic_store_n(&mem[frame * simpagesize + vaddr % PAGE_SIZE], val, __ATOMIC_RELAXED);
+	}
+}
+
+static void *cpu_main(void *arg)
+{
+	struct cpu *c = arg;
+	struct trace_ref ref;
+	int ret;
+
+	while ((ret = trace_next(c->trace, &ref)) > 0) {
+		cpu_ref(c, ref.type, ref.vaddr, ref.val);
+	}
+	c->failed = ret < 0;
+
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&c->state, CPU_DONE, __ATOMIC_SEQ_CST);
+	live -= 1;
+	pthread_cond_signal(&kernel_wake);
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+//---------------------------------------------------------------------
+
+static void print_report(double wall)
+{
+	size_t refs = 0;
+
+	printf("\nMulti-core replay on %zu CPUs\n", ncpus);
+	for (size_t i = 0; i < ncpus; i++) {
+		struct cpu *c = &cpus[i];
+		refs += c->refs;
+		printf("  CPU %zu: %zu references, TLB hit rate %.2f%%, %zu faults, "
+		       "%zu log drains, %zu IPIs serviced, %.3f ms in traps\n",
+		       i, c->refs, c->refs ? 100.0 * c->tlb_hits / c->refs : 0.0,
+		       c->faults, c->drains, c->ipis, c->trap_time * 1000.0);
+	}
+	printf("TLB shootdowns: %zu (%zu local flushes)\n", shootdowns, local_flushes);
+	printf("Wall time: %.3f s (%.0f references/s)\n", wall, wall > 0 ? refs / wall : 0.0);
+}
+
+/*
+ * Replays the comma-separated traces in job->tracefile on one simulated CPU
+ * each. The page table, coremap, swap and replacement algorithm must have
+ * been initialized by the calling thread, which handles the faults.
+ * Returns 0 on success, or -1 if a trace could not be opened or replayed.
+ */
+int mc_replay(const struct sim_job *job)
+{
+	char *names = strdup(job->tracefile);
+	int ret = 0;
+
+	ncpus = 1;
+	for (const char *p = names; *p; p++) {
+		ncpus += (*p == ',');
+	}
+	if (ncpus > MC_MAX_CPUS) {
+		fprintf(stderr, "Error: at most %d CPUs are supported\n", MC_MAX_CPUS);
+		free(names);
+		return -1;
+	}
+
+	cpus = aligned_alloc(64, ncpus * sizeof(struct cpu));
+	memset(cpus, 0, ncpus * sizeof(struct cpu));
+	char *save = NULL;
+	char *name = strtok_r(names, ",", &save);
+	for (size_t i = 0; i < ncpus; i++, name = strtok_r(NULL, ",", &save)) {
+		cpus[i].id = i;
+		pthread_cond_init(&cpus[i].wake, NULL);
+		if (!name) {
+			fprintf(stderr, "Error: empty trace name in %s\n", job->tracefile);
+			ret = -1;
+		} else if (!(cpus[i].trace = trace_open(name))) {
+			ret = -1;
+		}
+	}
+
+	if (ret == 0) {
+		root = pagetable_root();
+		mem = physmem;
+		frame_cpus = calloc(memsize, sizeof(uint64_t));
+		frame_vpn = calloc(memsize, sizeof(vaddr_t));
+		shootdowns = local_flushes = 0;
+		shootdown_func = mc_shootdown;
+
+		double start = wall_time();
+		live = ncpus;
+		for (size_t i = 0; i < ncpus; i++) {
+			pthread_create(&cpus[i].thread, NULL, cpu_main, &cpus[i]);
+		}
+		kernel_loop();
+		for (size_t i = 0; i < ncpus; i++) {
+			pthread_join(cpus[i].thread, NULL);
+		}
+		drain_reflogs();
+		double wall = wall_time() - start;
+
+		// References that did not trap were hits
+		for (size_t i = 0; i < ncpus; i++) {
+			hit_count += cpus[i].refs - cpus[i].faults;
+			ret |= cpus[i].failed ? -1 : 0;
+		}
+		ref_count = hit_count + miss_count;
+
+		shootdown_func = NULL;
+		if (job->report) {
+			print_report(wall);
+		}
+		free(frame_cpus);
+		free(frame_vpn);
+	}
+
+	for (size_t i = 0; i < ncpus; i++) {
+		if (cpus[i].trace) {
+			trace_close(cpus[i].trace);
+		}
+		pthread_cond_destroy(&cpus[i].wake);
+	}
+	free(cpus);
+	free(names);
+	return ret;
+}
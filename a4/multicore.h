@@ -0,0 +1,17 @@
+#ifndef __MULTICORE_H__
+#define __MULTICORE_H__
+
+#include <stdbool.h>
+#include "sim.h"
+
+
+// Multi-core mode: replay one trace per simulated CPU, concurrently, against
+// a single page table and coremap
+
+/* Most simulated CPUs, one bit each in the per-frame CPU masks */
+#define MC_MAX_CPUS 64
+
+int mc_replay(const struct sim_job *job);
+
+
+#endif /* __MULTICORE_H__ */
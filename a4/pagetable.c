@@ -19,60 +19,235 @@
 #include "pagetable_generic.h"
 #include "pagetable.h"
 #include "swap.h"
+#include "checkpoint.h"
 
 
 // Counters for various events.
 // Your code must increment these when the related events occur.
-size_t hit_count = 0;
-size_t miss_count = 0;
-size_t ref_count = 0;
-size_t evict_clean_count = 0;
-size_t evict_dirty_count = 0;
-
-pd_entry_t pdpt[PT_SIZE];
+__thread size_t hit_count = 0;
+__thread size_t miss_count = 0;
+__thread size_t ref_count = 0;
+__thread size_t evict_clean_count = 0;
+__thread size_t evict_dirty_count = 0;
+__thread size_t minor_fault_count = 0;
+__thread size_t major_fault_count = 0;
+
+__thread size_t evict_batch_count = 0;
+__thread size_t evict_batch_max = 0;
+__thread size_t swap_write_count = 0;
+__thread size_t swap_write_saved = 0;
+__thread size_t clean_writeback_count = 0;
+__thread size_t walk_count = 0;
+__thread size_t walk_cache_hit_count = 0;
+
+// Number of victims reclaimed each time we run out of free frames. The low
+// watermark is zero free frames; reclaim refills the free list up to this
+// high watermark, the way kswapd would.
+__thread size_t evict_batch_size = 1;
+
+__thread pd_entry_t pdpt[PT_SIZE];
+
+// Paging-structure cache, like the one an MMU keeps: the third-level tables
+// of recently walked 16 MiB regions (vaddr >> 24), direct-mapped. Tables are
+// only freed at the end of the run, so entries never go stale.
+#define WALK_CACHE_SIZE 16
+
+struct walk_cache_entry {
+	vaddr_t region;
+	pt_entry_t *pt;  // NULL if the entry is unused
+};
+static __thread struct walk_cache_entry walk_cache[WALK_CACHE_SIZE];
+
+// Called after a page has been unmapped from frame, so that multi-core mode
+// can shoot down the TLB entries other simulated CPUs hold for it.
+// NULL when a single trace is replayed.
+__thread void (*shootdown_func)(int frame) = NULL;
+
+// Called with each frame whose page is evicted, before the frame is reused,
+// so that shadow mode can log the victims. NULL otherwise.
+__thread void (*victim_func)(int frame) = NULL;
+
+// Frames not holding any page. Used as a stack, so initially the lowest
+// numbered frames are handed out first.
+static __thread int *free_frames;
+static __thread size_t free_count;
 
 /*
- * Allocates a frame to be used for the virtual page represented by p.
- * If all frames are in use, calls the replacement algorithm's evict_func to
- * select a victim frame. Writes victim to swap if needed, and updates
- * page table entry for victim to indicate that virtual page is no longer in
- * (simulated) physical memory.
- *
- * Counters for evictions should be updated appropriately in this function.
+ * Chooses up to n distinct victim frames using the replacement algorithm.
+ * Victims are taken off the coremap as they are chosen. An algorithm that
+ * only provides evict_func is asked again until it picks a frame already
+ * taken, which ends the batch early: asking once more would most likely
+ * give the same answer.
+ * Returns the number of victims stored in victims.
  */
-static int allocate_frame(pt_entry_t *pte)
+static size_t select_victims(int *victims, size_t n)
 {
-	int frame = -1;
-	for (size_t i = 0; i < memsize; i++) {
-		if (!coremap[i].in_use) {
-			frame = i;
-			break;
+	size_t count = 0;
+
+	if (n > 1 && evict_batch_func != NULL) {
+		// The algorithm guarantees the victims are distinct
+		count = evict_batch_func(victims, n);
+		for (size_t i = 0; i < count; i++) {
+			coremap[victims[i]].in_use = false;
 		}
+		return count;
 	}
 
-	if (frame == -1) { // Didn't find a free page.
-		// Call replacement algorithm's evict function to select victim
-		frame = evict_func();
+	while (count < n) {
+		int frame = evict_func();
 		assert(frame != -1);
+		if (!coremap[frame].in_use) {
+			break;
+		}
+		coremap[frame].in_use = false;
+		victims[count++] = frame;
+	}
+	return count;
+}
 
-		// All frames were in use, so victim frame must hold some page
-		// Write victim page to swap, if needed, and update page table
+/*
+ * Clears the given flags in the entry for the page held in frame and shoots
+ * down any cached translations of it.
+ * Returns the flags the entry had just before. The update is atomic, as
+ * other simulated CPUs may be setting REF and DIRTY concurrently in
+ * multi-core mode.
+ */
+static int unmap_flags(int frame, int flags)
+{
+	int old = __atomic_fetch_and(&coremap[frame].pte->value, ~flags, __ATOMIC_SEQ_CST);
+	if (shootdown_func) {
+		shootdown_func(frame);
+	}
+	return old;
+}
 
-		// IMPLEMENTATION NEEDED
-		pt_entry_t * victim = coremap[frame].pte;
+/*
+ * Writes the dirty victims in frames to swap. A batch of more than one page
+ * goes to contiguous swap slots in a single vectored write; if no such run
+ * of slots is free, each page is written separately.
+ */
+static void write_victims(const int *frames, size_t n)
+{
+	off_t offsets[MAX_EVICT_BATCH];
 
-		if (victim->value & DIRTY){
-			victim->swap_off = swap_pageout(frame, victim->swap_off);
-			evict_dirty_count += 1;
-			victim->value &= ~DIRTY;
-			victim->value |= ONSWAP;
+	if (n == 0) {
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		offsets[i] = coremap[frames[i]].pte->swap_off;
+	}
+
+	if (n > 1 && swap_pageout_batch(frames, offsets, n) == 0) {
+		swap_write_count += 1;
+		swap_write_saved += n - 1;
+	} else {
+		for (size_t i = 0; i < n; i++) {
+			offsets[i] = swap_pageout(frames[i], offsets[i]);
+			swap_write_count += 1;
 		}
-		else{
+	}
+
+	// Callers have already cleared DIRTY, before the write
+	for (size_t i = 0; i < n; i++) {
+		pt_entry_t *victim = coremap[frames[i]].pte;
+		victim->swap_off = offsets[i];
+		__atomic_fetch_or(&victim->value, ONSWAP, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Runs when there are no free frames left. Asks the replacement algorithm for
+ * up to evict_batch_size victims, writes the dirty ones to swap, updates the
+ * page table entries of all victims to indicate that their virtual pages are
+ * no longer in (simulated) physical memory and puts the frames on the free
+ * list.
+ *
+ * Counters for evictions are updated in this function.
+ */
+static void reclaim_frames(void)
+{
+	int victims[MAX_EVICT_BATCH];
+	int dirty[MAX_EVICT_BATCH];
+	size_t ndirty = 0;
+
+	size_t nvictims = select_victims(victims, evict_batch_size);
+	assert(nvictims > 0);
+
+	for (size_t i = 0; i < nvictims; i++) {
+		if (victim_func) {
+			victim_func(victims[i]);
+		}
+		if (unmap_flags(victims[i], VALID | DIRTY) & DIRTY) {
+			dirty[ndirty++] = victims[i];
+			evict_dirty_count += 1;
+		} else {
 			evict_clean_count += 1;
 		}
+	}
+	write_victims(dirty, ndirty);
+
+	// Push in reverse so that victims are reused in the order they were chosen
+	for (size_t i = nvictims; i > 0; i--) {
+		free_frames[free_count++] = victims[i - 1];
+	}
+
+	evict_batch_count += 1;
+	if (nvictims > evict_batch_max) {
+		evict_batch_max = nvictims;
+	}
+}
+
+/*
+ * Evicts the page held in frame outside of the normal reclaim path, for
+ * algorithms that shrink the resident set on their own (such as the working
+ * set algorithm). The frame goes back on the free list. It must not hold the
+ * page that is currently being referenced.
+ */
+void release_frame(int frame)
+{
+	assert(coremap[frame].in_use);
+	coremap[frame].in_use = false;
 
-		victim->value &= ~VALID;
+	if (victim_func) {
+		victim_func(frame);
 	}
+	if (unmap_flags(frame, VALID | DIRTY) & DIRTY) {
+		write_victims(&frame, 1);
+		evict_dirty_count += 1;
+	} else {
+		evict_clean_count += 1;
+	}
+	free_frames[free_count++] = frame;
+}
+
+/*
+ * Writes the dirty page held in frame to swap without evicting it, so that
+ * evicting it later is cheap (as WSClock does for old dirty pages).
+ */
+void clean_frame(int frame)
+{
+	assert(coremap[frame].in_use);
+	// Write-protect the page first so that a store racing with the
+	// write-back marks it dirty again
+	if (is_dirty(coremap[frame].pte) &&
+	    unmap_flags(frame, DIRTY) & DIRTY) {
+		write_victims(&frame, 1);
+		clean_writeback_count += 1;
+	}
+}
+
+/*
+ * Allocates a frame to be used for the virtual page represented by p.
+ * If all frames are in use, reclaims a batch of frames chosen by the
+ * replacement algorithm first.
+ */
+static int allocate_frame(pt_entry_t *pte)
+{
+	if (free_count == 0) {
+		reclaim_frames();
+	}
+	assert(free_count > 0);
+	int frame = free_frames[--free_count];
 
 	// Record information for virtual page that will now be stored in frame
 	coremap[frame].in_use = true;
@@ -95,9 +270,30 @@ static int allocate_frame(pt_entry_t *pte)
  */
 void init_pagetable(void)
 {
+	hit_count = miss_count = ref_count = 0;
+	evict_clean_count = evict_dirty_count = 0;
+	minor_fault_count = major_fault_count = 0;
+	evict_batch_count = evict_batch_max = 0;
+	swap_write_count = swap_write_saved = 0;
+	clean_writeback_count = 0;
+	walk_count = walk_cache_hit_count = 0;
+
 	for (int i = 0; i < PT_SIZE; i++){
 		pdpt[i].pt = 0;
 	}
+	memset(walk_cache, 0, sizeof(walk_cache));
+
+	free_frames = malloc(memsize * sizeof(int));
+	free_count = 0;
+	for (size_t i = memsize; i > 0; i--) {
+		coremap[i - 1].in_use = false;
+		coremap[i - 1].pte = NULL;
+		coremap[i - 1].frame = i - 1;
+		coremap[i - 1].next = NULL;
+		coremap[i - 1].prev = NULL;
+		frame_last_use[i - 1] = 0;
+		free_frames[free_count++] = i - 1;
+	}
 }
 
 pd_entry_t init_second_level(void)
@@ -133,8 +329,95 @@ pd_entry_t init_third_level(void)
 static void init_frame(int frame)
 {
 	// Calculate pointer to start of frame in (simulated) physical memory
-	unsigned char *mem_ptr = &physmem[frame * SIMPAGESIZE];
-	memset(mem_ptr, 0, SIMPAGESIZE); // zero-fill the frame
+	unsigned char *mem_ptr = &physmem[frame * simpagesize];
+	memset(mem_ptr, 0, simpagesize); // zero-fill the frame
+}
+
+/*
+ * Walks the page table to the entry for vaddr, allocating the second and
+ * third level tables on the way if they do not exist yet. The upper two
+ * levels are skipped when the walk cache has the third-level table.
+ */
+static pt_entry_t *walk_pagetable(vaddr_t vaddr)
+{
+	uintptr_t top_index = (vaddr >> 36); // top 12 bit is for the first level
+	uintptr_t middle_index = (vaddr >> 24) & PT_MASK; // middle 12 bit is for the second level
+	uintptr_t bottom_index = (vaddr >> 12) & PT_MASK; // bottom 12 bit is for the third level
+
+	struct walk_cache_entry *wc = &walk_cache[(vaddr >> 24) % WALK_CACHE_SIZE];
+	walk_count += 1;
+	if (wc->pt != NULL && wc->region == (vaddr >> 24)) {
+		walk_cache_hit_count += 1;
+		return &wc->pt[bottom_index];
+	}
+
+	// New tables are published with release stores so that other simulated
+	// CPUs walking the table in multi-core mode see them initialized
+	if (!(pdpt[top_index].pt & VALID)){
+		__atomic_store_n(&pdpt[top_index].pt, init_second_level().pt, __ATOMIC_RELEASE);
+	}
+	uintptr_t second_ptp = pdpt[top_index].pt;
+	pd_entry_t *second_pt = (pd_entry_t *)(second_ptp & ~VALID); // reset the valid bit to get the second level pt
+
+	if (!(second_pt[middle_index].pt & VALID)){
+		__atomic_store_n(&second_pt[middle_index].pt, init_third_level().pt, __ATOMIC_RELEASE);
+	}
+	uintptr_t third_ptp = second_pt[middle_index].pt;
+	pt_entry_t *third_pt = (pt_entry_t *)(third_ptp & ~VALID); // reset the valid bit to get the third level pt
+
+	wc->region = vaddr >> 24;
+	wc->pt = third_pt;
+	return &(third_pt[bottom_index]);
+}
+
+/*
+ * Looks up the entry for vaddr in the page table at root without changing
+ * anything, the way the MMU of another simulated CPU walks it.
+ * Returns NULL if the tables covering vaddr do not exist yet.
+ */
+pt_entry_t *lookup_pagetable(pd_entry_t *root, vaddr_t vaddr)
+{
+	uintptr_t second_ptp = __atomic_load_n(&root[vaddr >> 36].pt, __ATOMIC_ACQUIRE);
+	if (!(second_ptp & VALID)) {
+		return NULL;
+	}
+	pd_entry_t *second_pt = (pd_entry_t *)(second_ptp & ~VALID);
+	uintptr_t third_ptp = __atomic_load_n(&second_pt[(vaddr >> 24) & PT_MASK].pt, __ATOMIC_ACQUIRE);
+	if (!(third_ptp & VALID)) {
+		return NULL;
+	}
+	pt_entry_t *third_pt = (pt_entry_t *)(third_ptp & ~VALID);
+	return &third_pt[(vaddr >> 12) & PT_MASK];
+}
+
+/* Returns the top level of the page table, to share with other threads. */
+pd_entry_t *pagetable_root(void)
+{
+	return pdpt;
+}
+
+/*
+ * Makes the page for pte resident in a newly allocated frame, reading it
+ * from swap if it has been there. Updates the fault counters.
+ * Returns the frame; the entry is not marked valid yet.
+ */
+static int fault_in(pt_entry_t *pte)
+{
+	int frame = allocate_frame(pte);
+	int value = frame << PAGE_SHIFT;
+	if (pte->value & ONSWAP){
+		swap_pagein(frame, pte->swap_off);
+		major_fault_count += 1;
+		value |= ONSWAP;
+	}
+	else{
+		init_frame(frame);
+		minor_fault_count += 1;
+		value |= DIRTY;
+	}
+	// Other simulated CPUs may be reading the (invalid) entry
+	__atomic_store_n(&pte->value, value, __ATOMIC_RELAXED);
+	return frame;
 }
 
 /*
@@ -164,23 +447,7 @@ unsigned char *find_physpage(vaddr_t vaddr, char type)
 	// (void)init_frame;
 
 	// IMPLEMENTATION NEEDED
-	uintptr_t top_index = (vaddr >> 36); // top 12 bit is for the first level
-	uintptr_t middle_index = (vaddr >> 24) & PT_MASK; // middle 12 bit is for the second level
-	uintptr_t bottom_index = (vaddr >> 12) & PT_MASK; // bottom 12 bit is for the third level
-
-	if (!(pdpt[top_index].pt & VALID)){
-		pdpt[top_index] = init_second_level();
-	}
-	uintptr_t second_ptp = pdpt[top_index].pt;
-	pd_entry_t *second_pt = (pd_entry_t *)(second_ptp & ~VALID); // reset the valid bit to get the second level pt
-
-	if (!(second_pt[middle_index].pt & VALID)){
-		second_pt[middle_index] = init_third_level();
-	}
-	uintptr_t third_ptp = second_pt[middle_index].pt;
-	pt_entry_t *third_pt = (pt_entry_t *)(third_ptp & ~VALID); // reset the valid bit to get the third level pt
-
-	pt_entry_t* pte = &(third_pt[bottom_index]);
+	pt_entry_t* pte = walk_pagetable(vaddr);
 
 	// Check if pte is valid or not, on swap or not, and handle appropriately
 	// (Note that the first acess to a page should be marked DIRTY)
@@ -188,17 +455,7 @@ unsigned char *find_physpage(vaddr_t vaddr, char type)
 	// dirty if the access type indicates that the page will be written to.
 	if (!(pte->value & VALID)){
 		miss_count += 1;
-		frame = allocate_frame(pte);
-		if (pte->value & ONSWAP){
-			swap_pagein(frame, pte->swap_off);
-			pte->value = frame << PAGE_SHIFT;
-			pte->value |= ONSWAP;
-		}
-		else{
-			init_frame(frame);
-			pte->value = frame << PAGE_SHIFT;
-			pte->value |= DIRTY;
-		}
+		frame = fault_in(pte);
 	}
 	else{
 		hit_count += 1;
@@ -214,15 +471,63 @@ unsigned char *find_physpage(vaddr_t vaddr, char type)
 
 	if ((type == 'S') | (type == 'M')) {
 		pte->value |= DIRTY;
+		// The copy on swap is stale now, so give its slot back
+		if (pte->swap_off != INVALID_SWAP) {
+			swap_free(pte->swap_off);
+			pte->swap_off = INVALID_SWAP;
+			pte->value &= ~ONSWAP;
+		}
 	}
 
 	// Call replacement algorithm's ref_func for this page.
 	ref_count += 1;
 	assert(frame != -1);
+	frame_last_use[frame] = ref_count;
 	ref_func(frame);
 
 	// Return pointer into (simulated) physical memory at start of frame
-	return &physmem[frame * SIMPAGESIZE];
+	return &physmem[frame * simpagesize];
+}
+
+
+/*
+ * Handles a page fault taken by another simulated CPU in multi-core mode:
+ * the same as find_physpage(), except that the entry is updated atomically
+ * because other CPUs may be reading it or setting REF and DIRTY in it. The
+ * page may have been faulted in by another CPU in the meantime, in which
+ * case this is a hit.
+ * Returns the frame that holds vaddr.
+ */
+int fault_physpage(vaddr_t vaddr, char type)
+{
+	pt_entry_t *pte = walk_pagetable(vaddr);
+	int flags = VALID | REF;
+	int frame;
+
+	if ((type == 'S') | (type == 'M')) {
+		flags |= DIRTY;
+	}
+	int value = __atomic_load_n(&pte->value, __ATOMIC_ACQUIRE);
+	if (!(value & VALID)) {
+		miss_count += 1;
+		frame = fault_in(pte);
+		// Publish the entry only now that the frame holds the page
+		__atomic_fetch_or(&pte->value, flags, __ATOMIC_RELEASE);
+	} else {
+		hit_count += 1;
+		frame = value >> PAGE_SHIFT;
+		__atomic_fetch_or(&pte->value, flags, __ATOMIC_RELAXED);
+	}
+	if ((flags & DIRTY) && pte->swap_off != INVALID_SWAP) {
+		swap_free(pte->swap_off);
+		pte->swap_off = INVALID_SWAP;
+		__atomic_fetch_and(&pte->value, ~ONSWAP, __ATOMIC_RELAXED);
+	}
+
+	ref_count += 1;
+	frame_last_use[frame] = ref_count;
+	ref_func(frame);
+	return frame;
 }
 
 
@@ -233,6 +538,7 @@ void print_pagetable(void)
 
 void free_pagetable(void)
 {
+	free(free_frames);
 	for (int i = 0; i < PT_SIZE; i++){
 		if (pdpt[i].pt & VALID){
 			pd_entry_t* second_pt = (pd_entry_t *)(pdpt[i].pt & ~VALID);
@@ -247,15 +553,170 @@ void free_pagetable(void)
 	}
 }
 
+bool is_valid(struct pt_entry_s *pte){
+	return __atomic_load_n(&pte->value, __ATOMIC_RELAXED) & VALID;
+}
+bool is_dirty(struct pt_entry_s *pte){
+	return __atomic_load_n(&pte->value, __ATOMIC_RELAXED) & DIRTY;
+}
 bool get_referenced(struct pt_entry_s *pte){
-	return pte->value & REF;
+	return __atomic_load_n(&pte->value, __ATOMIC_RELAXED) & REF;
 }
 void set_referenced(struct pt_entry_s *pte, bool val){
+	// Atomic, as other simulated CPUs may be setting DIRTY at the same time
 	if (val){
-		pte->value |= REF;
+		__atomic_fetch_or(&pte->value, REF, __ATOMIC_RELAXED);
 	}
 	else{
-		pte->value &= ~REF;
+		__atomic_fetch_and(&pte->value, ~REF, __ATOMIC_RELAXED);
 	}
 }
 
+
+//---------------------------------------------------------------------
+// Checkpoint support. Page table entries are saved as (virtual page number,
+// value, swap offset) records for every entry that has ever been used, ended
+// by a record with an all-ones page number. The coremap is rebuilt from the
+// valid entries on restore.
+
+#define NCOUNTERS 16
+
+struct pte_record {
+	uint64_t vpn;
+	int value;
+	off_t swap_off;
+};
+
+static void get_counters(size_t **c)
+{
+	size_t i = 0;
+	c[i++] = &hit_count;
+	c[i++] = &miss_count;
+	c[i++] = &ref_count;
+	c[i++] = &evict_clean_count;
+	c[i++] = &evict_dirty_count;
+	c[i++] = &minor_fault_count;
+	c[i++] = &major_fault_count;
+	c[i++] = &evict_batch_count;
+	c[i++] = &evict_batch_max;
+	c[i++] = &swap_write_count;
+	c[i++] = &swap_write_saved;
+	c[i++] = &clean_writeback_count;
+	c[i++] = &walk_count;
+	c[i++] = &walk_cache_hit_count;
+	c[i++] = &evict_batch_size;
+	c[i++] = &free_count;
+	assert(i == NCOUNTERS);
+}
+
+/*
+ * Writes the counters, page table, walk cache, free frame list,
+ * frame_last_use and the contents of (simulated) physical memory to f.
+ * Returns 0 on success and -1 on a write error.
+ */
+int pagetable_checkpoint(FILE *f)
+{
+	size_t *counters[NCOUNTERS];
+	struct pte_record rec;
+	int ret = 0;
+
+	get_counters(counters);
+	for (int i = 0; i < NCOUNTERS; i++) {
+		ret |= ckpt_put(f, counters[i], sizeof(size_t));
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	for (int i = 0; i < PT_SIZE; i++) {
+		if (!(pdpt[i].pt & VALID)) {
+			continue;
+		}
+		pd_entry_t *second_pt = (pd_entry_t *)(pdpt[i].pt & ~VALID);
+		for (int j = 0; j < PT_SIZE; j++) {
+			if (!(second_pt[j].pt & VALID)) {
+				continue;
+			}
+			pt_entry_t *third_pt = (pt_entry_t *)(second_pt[j].pt & ~VALID);
+			for (int k = 0; k < PT_SIZE; k++) {
+				if (third_pt[k].value == 0 && third_pt[k].swap_off == INVALID_SWAP) {
+					continue;
+				}
+				rec.vpn = ((uint64_t)i << 24) | ((uint64_t)j << 12) | k;
+				rec.value = third_pt[k].value;
+				rec.swap_off = third_pt[k].swap_off;
+				ret |= ckpt_put(f, &rec, sizeof(rec));
+			}
+		}
+	}
+	rec.vpn = UINT64_MAX;
+	ret |= ckpt_put(f, &rec, sizeof(rec));
+
+	// The regions in the walk cache, so that it hits the same way on resume
+	for (int i = 0; i < WALK_CACHE_SIZE; i++) {
+		uint64_t region = walk_cache[i].pt ? walk_cache[i].region : UINT64_MAX;
+		ret |= ckpt_put(f, &region, sizeof(region));
+	}
+
+	ret |= ckpt_put(f, free_frames, free_count * sizeof(int));
+	ret |= ckpt_put(f, frame_last_use, memsize * sizeof(size_t));
+	ret |= ckpt_put(f, physmem, memsize * simpagesize);
+	return ret;
+}
+
+/*
+ * Reads back what pagetable_checkpoint() wrote into a freshly initialized
+ * page table.
+ * Returns 0 on success and -1 on a read error or inconsistent data.
+ */
+int pagetable_restore(FILE *f)
+{
+	size_t *counters[NCOUNTERS];
+	struct pte_record rec;
+
+	get_counters(counters);
+	for (int i = 0; i < NCOUNTERS; i++) {
+		if (ckpt_get(f, counters[i], sizeof(size_t)) != 0) {
+			return -1;
+		}
+	}
+	if (free_count > memsize || evict_batch_size > MAX_EVICT_BATCH) {
+		return -1;
+	}
+
+	// Rebuilding the table is not part of the simulation
+	size_t walks = walk_count, walk_hits = walk_cache_hit_count;
+	while (ckpt_get(f, &rec, sizeof(rec)) == 0 && rec.vpn != UINT64_MAX) {
+		pt_entry_t *pte = walk_pagetable(rec.vpn << PAGE_SHIFT);
+		pte->value = rec.value;
+		pte->swap_off = rec.swap_off;
+		if (pte->value & VALID) {
+			size_t frame = pte->value >> PAGE_SHIFT;
+			if (frame >= memsize) {
+				return -1;
+			}
+			coremap[frame].in_use = true;
+			coremap[frame].pte = pte;
+		}
+	}
+	if (rec.vpn != UINT64_MAX) {
+		return -1;
+	}
+	memset(walk_cache, 0, sizeof(walk_cache));
+	for (int i = 0; i < WALK_CACHE_SIZE; i++) {
+		uint64_t region;
+		if (ckpt_get(f, &region, sizeof(region)) != 0) {
+			return -1;
+		}
+		if (region != UINT64_MAX) {
+			walk_pagetable(region << 24);
+		}
+	}
+	walk_count = walks;
+	walk_cache_hit_count = walk_hits;
+
+	if (ckpt_get(f, free_frames, free_count * sizeof(int)) != 0 ||
+	    ckpt_get(f, frame_last_use, memsize * sizeof(size_t)) != 0 ||
+	    ckpt_get(f, physmem, memsize * simpagesize) != 0) {
+		return -1;
+	}
+	return 0;
+}
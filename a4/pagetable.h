@@ -39,4 +39,8 @@ typedef struct pt_entry_s{
 	off_t swap_off;
 } pt_entry_t;
 
+// Page table access for the simulated CPUs of multi-core mode
+pt_entry_t *lookup_pagetable(pd_entry_t *root, vaddr_t vaddr);
+pd_entry_t *pagetable_root(void);
+
 #endif /* __PAGETABLE_H__ */
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <assert.h>
+#include <stdio.h>
 #include "sim.h"
 
 // Everything in this file should be independent of the actual page table format.
@@ -40,7 +41,12 @@ struct frame {
 	struct frame *prev;
 };
 
-extern struct frame *coremap;
+extern __thread struct frame *coremap;
+
+/* Virtual time (the value of ref_count) of the last reference to the page in
+ * each frame, indexed like the coremap.
+ */
+extern __thread size_t *frame_last_use;
 
 static inline void frame_list_init_head(struct frame *head)
 {
@@ -69,10 +75,14 @@ void init_pagetable(void);
 void print_pagetable(void);
 void free_pagetable(void);
 unsigned char *find_physpage(vaddr_t vaddr, char type);
+int fault_physpage(vaddr_t vaddr, char type);
+int access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum);
 bool is_valid(struct pt_entry_s *pte);
 bool is_dirty(struct pt_entry_s *pte);
 bool get_referenced(struct pt_entry_s *pte);
 void set_referenced(struct pt_entry_s *pte, bool val);
+void release_frame(int frame);
+void clean_frame(int frame);
 
 // Replacement algorithm functions
 // These may not need to do anything for some algorithms
@@ -82,6 +92,9 @@ void clock_init(void);
 void lru_init(void);
 void mru_init(void);
 void opt_init(void);
+void ws_init(void);
+void wsclock_init(void);
+void aging_init(void);
 
 // These may not need to do anything for some algorithms
 void rand_cleanup(void);
@@ -90,6 +103,9 @@ void clock_cleanup(void);
 void lru_cleanup(void);
 void mru_cleanup(void);
 void opt_cleanup(void);
+void ws_cleanup(void);
+void wsclock_cleanup(void);
+void aging_cleanup(void);
 
 // These may not need to do anything for some algorithms
 void rand_ref(int frame);
@@ -98,6 +114,9 @@ void clock_ref(int frame);
 void lru_ref(int frame);
 void mru_ref(int frame);
 void opt_ref(int frame);
+void ws_ref(int frame);
+void wsclock_ref(int frame);
+void aging_ref(int frame);
 
 int rand_evict(void);
 int rr_evict(void);
@@ -105,6 +124,48 @@ int clock_evict(void);
 int lru_evict(void);
 int mru_evict(void);
 int opt_evict(void);
+int ws_evict(void);
+int wsclock_evict(void);
+int aging_evict(void);
+
+// Optional: choose up to n distinct victims at once, returning how many
+// were stored in frames
+size_t clock_evict_batch(int *frames, size_t n);
+size_t lru_evict_batch(int *frames, size_t n);
+size_t ws_evict_batch(int *frames, size_t n);
+size_t aging_evict_batch(int *frames, size_t n);
+
+// Working set window (tau), in references, used by ws and wsclock
+extern __thread size_t ws_tau;
+
+// Save algorithm state to a checkpoint and restore it; return 0 on success
+// and -1 on error
+int rand_checkpoint(FILE *f);
+int rr_checkpoint(FILE *f);
+int clock_checkpoint(FILE *f);
+int lru_checkpoint(FILE *f);
+int ws_checkpoint(FILE *f);
+int wsclock_checkpoint(FILE *f);
+int aging_checkpoint(FILE *f);
+int ws_stats_checkpoint(FILE *f);
+
+int rand_restore(FILE *f);
+int rr_restore(FILE *f);
+int clock_restore(FILE *f);
+int lru_restore(FILE *f);
+int ws_restore(FILE *f);
+int wsclock_restore(FILE *f);
+int aging_restore(FILE *f);
+int ws_stats_restore(FILE *f);
+
+// Number of references between age counter updates in aging
+extern __thread size_t aging_interval;
+
+// Working set size sampling shared by ws and wsclock: ws_tick is called on
+// each reference, ws_report prints the samples after a run
+void ws_stats_init(void);
+void ws_tick(void);
+void ws_report(void);
 
 
 #endif /* __PAGETABLE_GENERIC_H__ */
@@ -0,0 +1,57 @@
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "policy.h"
+
+//---------------------------------------------------------------------
+// Loading replacement policies from shared objects.
+//
+// sim is linked with -rdynamic so that a plugin resolves memsize, coremap
+// and the pte accessors against the executable. Plugins are never unloaded:
+// batch mode may run the same plugin on several threads, and dlopen() of an
+// already loaded object just returns the same handle, so each one is mapped
+// once for the life of the process.
+
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Loads the policy defined in the shared object at path.
+ * Returns the policy, or NULL (after printing the reason) if the object
+ * cannot be loaded, does not define one or was built against a different
+ * version of the interface.
+ */
+const struct sim_policy *policy_load(const char *path)
+{
+	const struct sim_policy *policy = NULL;
+
+	// dlerror() state is per thread, but keep the messages of concurrent
+	// loads from interleaving
+	pthread_mutex_lock(&load_lock);
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		fprintf(stderr, "Error: cannot load %s: %s\n", path, dlerror());
+		goto out;
+	}
+
+	policy = dlsym(handle, SIM_POLICY_SYMBOL);
+	if (!policy) {
+		fprintf(stderr, "Error: %s does not define %s\n", path, SIM_POLICY_SYMBOL);
+		goto out;
+	}
+	if (policy->version != SIM_POLICY_VERSION) {
+		fprintf(stderr, "Error: %s was built for policy interface version %u, "
+		        "sim uses version %u\n", path, policy->version, SIM_POLICY_VERSION);
+		policy = NULL;
+		goto out;
+	}
+	if (!policy->name || !policy->init || !policy->cleanup ||
+	    !policy->ref || !policy->evict) {
+		fprintf(stderr, "Error: %s does not provide name, init, cleanup, "
+		        "ref and evict\n", path);
+		policy = NULL;
+	}
+out:
+	pthread_mutex_unlock(&load_lock);
+	return policy;
+}
@@ -0,0 +1,50 @@
+#include "../pagetable_generic.h"
+#include "../policy.h"
+#include "../checkpoint.h"
+
+// Example plugin: Most Recently Used replacement, which beats LRU on traces
+// that loop over more pages than fit in memory. Build it with
+// "make plugins" and run it with -a plugin:plugins/mru.so. The policy
+// functions are the mru_* ones declared in pagetable_generic.h.
+
+static __thread int mru_frame;
+
+/* Page to evict is the one referenced last. */
+int mru_evict(void)
+{
+	return mru_frame;
+}
+
+/* Remember the frame of every reference. */
+void mru_ref(int frame)
+{
+	mru_frame = frame;
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void mru_init(void)
+{
+	mru_frame = 0;
+}
+
+/* Cleanup any data structures created in mru_init(). */
+void mru_cleanup(void)
+{
+}
+
+/* Save the most recently used frame to a checkpoint. */
+static int mru_checkpoint(FILE *f)
+{
+	return ckpt_put(f, &mru_frame, sizeof(mru_frame));
+}
+
+/* Restore the frame saved by mru_checkpoint(). */
+static int mru_restore(FILE *f)
+{
+	return ckpt_get(f, &mru_frame, sizeof(mru_frame));
+}
+
+const struct sim_policy sim_policy = {
+	SIM_POLICY_VERSION, "mru", mru_init, mru_cleanup, mru_ref, mru_evict,
+	NULL, NULL, mru_checkpoint, mru_restore
+};
@@ -0,0 +1,44 @@
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Interface between the simulator and a page replacement policy.
+//
+// The built-in policies are listed in the algs[] table in sim.c. Others can
+// be built as shared objects that define a variable
+//
+//     const struct sim_policy sim_policy = { SIM_POLICY_VERSION, "name", ... };
+//
+// and run with -a plugin:path/to/policy.so, without rebuilding sim. A plugin
+// may use everything declared in pagetable_generic.h (memsize, the coremap,
+// the pte accessors). Batch mode runs simulations on several threads at
+// once, so a policy should keep its state in __thread variables.
+//
+// SIM_POLICY_VERSION is bumped whenever this struct or the meaning of one of
+// its hooks changes; sim refuses to load a plugin built against another
+// version.
+
+#define SIM_POLICY_VERSION 1
+#define SIM_POLICY_SYMBOL "sim_policy"
+#define SIM_POLICY_PREFIX "plugin:"
+
+struct sim_policy {
+	unsigned int version;     // SIM_POLICY_VERSION the policy was built with
+	const char *name;         // String name of eviction algorithm
+	void (*init)(void);       // Initialize any data needed by alg
+	void (*cleanup)(void);    // Cleanup any data initialized in init()
+	void (*ref)(int);	  // Called on each reference
+	int (*evict)(void);       // Called to choose victim for eviction
+
+	// Optional hooks, NULL if the policy does not provide them
+	size_t (*evict_batch)(int *, size_t); // Called to choose several victims
+	void (*report)(void);     // Called to print statistics after a run
+	int (*checkpoint)(FILE *); // Called to save alg state to a checkpoint
+	int (*restore)(FILE *);   // Called to load alg state from a checkpoint
+};
+
+const struct sim_policy *policy_load(const char *path);
+
+#endif /* __POLICY_H__ */
@@ -1,5 +1,12 @@
 #include <stdlib.h>
+#include <string.h>
 #include "pagetable_generic.h"
+#include "checkpoint.h"
+
+// Each simulation gets its own generator so that concurrent simulations in
+// batch mode neither share nor perturb each other's sequence.
+static __thread struct random_data rand_state;
+static __thread int32_t rand_statebuf[32];
 
 
 /* Page to evict is chosen using the RAND algorithm.
@@ -8,8 +15,9 @@
  */
 int rand_evict(void)
 {
-	//NOTE: We keep the default seed (don't call srandom) for repeatable results
-	return random() % memsize;
+	int32_t r;
+	random_r(&rand_state, &r);
+	return r % memsize;
 }
 
 /* This function is called on each access to a page to update any information
@@ -24,9 +32,36 @@ void rand_ref(int frame)
 /* Initialize any data structures needed for this replacement algorithm. */
 void rand_init(void)
 {
+	//NOTE: We use random()'s default seed of 1 for repeatable results
+	memset(&rand_state, 0, sizeof(rand_state));
+	initstate_r(1, (char *)rand_statebuf, sizeof(rand_statebuf), &rand_state);
 }
 
 /* Cleanup any data structures created in rand_init(). */
 void rand_cleanup(void)
 {
 }
+
+/* Save the generator state to a checkpoint. */
+int rand_checkpoint(FILE *f)
+{
+	int32_t fpos = rand_state.fptr - rand_statebuf;
+	int32_t rpos = rand_state.rptr - rand_statebuf;
+	return ckpt_put(f, rand_statebuf, sizeof(rand_statebuf)) |
+	       ckpt_put(f, &fpos, sizeof(fpos)) | ckpt_put(f, &rpos, sizeof(rpos));
+}
+
+/* Restore the generator state saved by rand_checkpoint(). */
+int rand_restore(FILE *f)
+{
+	int32_t fpos, rpos;
+	if (ckpt_get(f, rand_statebuf, sizeof(rand_statebuf)) != 0 ||
+	    ckpt_get(f, &fpos, sizeof(fpos)) != 0 ||
+	    ckpt_get(f, &rpos, sizeof(rpos)) != 0 ||
+	    fpos < 0 || fpos >= 32 || rpos < 0 || rpos >= 32) {
+		return -1;
+	}
+	rand_state.fptr = rand_statebuf + fpos;
+	rand_state.rptr = rand_statebuf + rpos;
+	return 0;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "region.h"
+
+//---------------------------------------------------------------------
+// Regions are kept in an array sorted by address, so the region of a
+// reference is found by binary search, after checking the region of the
+// previous reference (usually the same one).
+//
+// With -r auto the regions are clusters of touched pages. A page within
+// CLUSTER_GAP of a cluster extends it, a page that closes the gap between
+// two clusters merges them, and any other page starts a new cluster, so a
+// cluster covers a run of pages with no hole larger than the gap. Clusters
+// are labelled from where they lie and what they hold: code if most of its
+// references are instruction fetches, stack near the top of the user
+// address space, mmap just below it, and heap otherwise.
+//
+// Otherwise -r names a file of address ranges, one per line:
+//
+//     # name  start     end (exclusive)
+//     code    0x400000  0x500000
+//
+// and references outside all of them are counted as "other".
+//
+// Evictions are seen through victim_func. The page held in each frame is
+// remembered, so an evicted frame can be charged to the region of its page.
+
+#define CLUSTER_GAP (1UL << 20)
+#define STACK_BASE 0x7ff000000000UL
+#define MMAP_BASE 0x7f0000000000UL
+#define MAX_NAME 32
+
+struct region {
+	char name[MAX_NAME];
+	vaddr_t start;      // first address
+	vaddr_t end;        // one past the last address
+	size_t refs;
+	size_t instr_refs;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t dirty_evictions;
+	size_t resident;    // pages of the region in memory
+	size_t peak_resident;
+};
+
+static struct region *regions;
+static size_t nregions;
+static size_t capacity;
+static struct region other;    // outside all ranges from the file
+static bool auto_detect;
+static size_t last;            // index of the region of the last reference
+static vaddr_t *frame_page;    // page held in each frame
+
+static struct region *insert_region(size_t i)
+{
+	if (nregions == capacity) {
+		capacity = capacity ? 2 * capacity : 16;
+		regions = realloc(regions, capacity * sizeof(struct region));
+		if (!regions) {
+			perror("Failed to allocate regions");
+			exit(1);
+		}
+	}
+	memmove(&regions[i + 1], &regions[i], (nregions - i) * sizeof(struct region));
+	nregions += 1;
+	memset(&regions[i], 0, sizeof(struct region));
+	return &regions[i];
+}
+
+/* Grows the clusters to take in vaddr, which is not in any of them.
+ * i is the index of the first cluster above vaddr. */
+static struct region *add_page(vaddr_t vaddr, size_t i)
+{
+	vaddr_t page = vaddr & PAGE_MASK;
+	vaddr_t page_end = page + PAGE_SIZE;
+	bool join_prev = i > 0 && page - regions[i - 1].end <= CLUSTER_GAP;
+	bool join_next = i < nregions && regions[i].start - page_end <= CLUSTER_GAP;
+
+	if (join_prev && join_next) {
+		struct region *r = &regions[i - 1];
+		const struct region *n = &regions[i];
+		r->end = n->end;
+		r->refs += n->refs;
+		r->instr_refs += n->instr_refs;
+		r->hits += n->hits;
+		r->misses += n->misses;
+		r->evictions += n->evictions;
+		r->dirty_evictions += n->dirty_evictions;
+		r->resident += n->resident;
+		// An upper bound, as the two peaks may not have coincided
+		r->peak_resident += n->peak_resident;
+		memmove(&regions[i], &regions[i + 1], (nregions - i - 1) * sizeof(struct region));
+		nregions -= 1;
+		i -= 1;
+	} else if (join_prev) {
+		regions[--i].end = page_end;
+	} else if (join_next) {
+		regions[i].start = page;
+	} else {
+		struct region *r = insert_region(i);
+		r->start = page;
+		r->end = page_end;
+	}
+	last = i;
+	return &regions[i];
+}
+
+static struct region *find_region(vaddr_t vaddr)
+{
+	if (last < nregions && regions[last].start <= vaddr && vaddr < regions[last].end) {
+		return &regions[last];
+	}
+
+	// First region that ends above vaddr
+	size_t lo = 0, hi = nregions;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (regions[mid].end <= vaddr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < nregions && regions[lo].start <= vaddr) {
+		last = lo;
+		return &regions[lo];
+	}
+	return auto_detect ? add_page(vaddr, lo) : &other;
+}
+
+static int load_ranges(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	char line[256];
+	size_t linenum = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char name[MAX_NAME];
+		vaddr_t start, end;
+		char first;
+
+		++linenum;
+		if (sscanf(line, " %c", &first) != 1 || first == '#') {
+			continue;
+		}
+		if (sscanf(line, "%31s %lx %lx", name, &start, &end) != 3 || start >= end) {
+			fprintf(stderr, "%s: invalid range on line %zu: %s", path, linenum, line);
+			fclose(f);
+			return -1;
+		}
+
+		size_t i = 0;
+		while (i < nregions && regions[i].start < start) {
+			i++;
+		}
+		if ((i > 0 && regions[i - 1].end > start) ||
+		    (i < nregions && regions[i].start < end)) {
+			fprintf(stderr, "%s: range on line %zu overlaps another\n", path, linenum);
+			fclose(f);
+			return -1;
+		}
+		struct region *r = insert_region(i);
+		strcpy(r->name, name);
+		r->start = start;
+		r->end = end;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void region_victim(int frame)
+{
+	struct region *r = find_region(frame_page[frame]);
+	r->evictions += 1;
+	if (is_dirty(coremap[frame].pte)) {
+		r->dirty_evictions += 1;
+	}
+	r->resident -= 1;
+}
+
+/* Sets up per-region statistics for a simulation with memsize frames. spec
+ * is "auto" or the name of a file of address ranges.
+ * Returns 0 on success and -1 if the file cannot be read or is invalid. */
+int region_init(const char *spec, size_t memsize)
+{
+	memset(&other, 0, sizeof(other));
+	strcpy(other.name, "other");
+	auto_detect = strcmp(spec, "auto") == 0;
+	if (!auto_detect && load_ranges(spec) != 0) {
+		region_destroy();
+		return -1;
+	}
+
+	frame_page = calloc(memsize, sizeof(vaddr_t));
+	if (!frame_page) {
+		perror("Failed to allocate regions");
+		exit(1);
+	}
+	victim_func = region_victim;
+	return 0;
+}
+
+/* Called after each reference has been simulated, with the frame that now
+ * holds the page and whether the page was already resident. */
+void region_ref(vaddr_t vaddr, char type, int frame, bool hit)
+{
+	struct region *r = find_region(vaddr);
+
+	r->refs += 1;
+	if (type == 'I') {
+		r->instr_refs += 1;
+	}
+	if (hit) {
+		r->hits += 1;
+	} else {
+		r->misses += 1;
+		if (++r->resident > r->peak_resident) {
+			r->peak_resident = r->resident;
+		}
+	}
+	frame_page[frame] = vaddr & PAGE_MASK;
+}
+
+static const char *cluster_label(const struct region *r)
+{
+	if (2 * r->instr_refs > r->refs) {
+		return "code";
+	}
+	if (r->start >= STACK_BASE) {
+		return "stack";
+	}
+	if (r->start >= MMAP_BASE) {
+		return "mmap";
+	}
+	return "heap";
+}
+
+static void print_region(const struct region *r)
+{
+	char addrs[32] = "-";
+	if (r != &other) {
+		snprintf(addrs, sizeof(addrs), "0x%012lx-0x%012lx", r->start, r->end);
+	}
+	printf("  %-8s %-29s %10zu %8.2f%% %10zu %10zu %10zu %10zu %10zu\n",
+	       r->name, addrs, r->refs,
+	       r->refs ? 100.0 * r->hits / r->refs : 0.0, r->misses,
+	       r->evictions, r->dirty_evictions, r->resident, r->peak_resident);
+}
+
+void region_print(void)
+{
+	if (auto_detect) {
+		printf("\nRegions (clusters with gaps under %lu KB):\n", CLUSTER_GAP >> 10);
+	} else {
+		printf("\nRegions:\n");
+	}
+	printf("  %-8s %-29s %10s %9s %10s %10s %10s %10s %10s\n", "region",
+	       "addresses", "refs", "hit rate", "misses", "evictions", "dirty",
+	       "resident", "peak");
+	for (size_t i = 0; i < nregions; i++) {
+		if (auto_detect) {
+			strcpy(regions[i].name, cluster_label(&regions[i]));
+		}
+		print_region(&regions[i]);
+	}
+	if (other.refs) {
+		print_region(&other);
+	}
+}
+
+void region_destroy(void)
+{
+	victim_func = NULL;
+	free(regions);
+	free(frame_page);
+	regions = NULL;
+	frame_page = NULL;
+	nregions = capacity = last = 0;
+}
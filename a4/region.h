@@ -0,0 +1,19 @@
+#ifndef __REGION_H__
+#define __REGION_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "pagetable_generic.h"
+
+
+// Statistics broken down by region of the address space (-r): references,
+// hits, misses, evictions and resident pages for each address range given
+// in a file, or for each cluster of pages found while replaying the trace.
+
+int region_init(const char *spec, size_t memsize);
+void region_ref(vaddr_t vaddr, char type, int frame, bool hit);
+void region_print(void);
+void region_destroy(void);
+
+
+#endif /* __REGION_H__ */
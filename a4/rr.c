@@ -1,5 +1,7 @@
 #include "pagetable_generic.h"
+#include "checkpoint.h"
 
+static __thread int rr_next;
 
 /* Page to evict is chosen using the Round Robin algorithm.
  * Since our simulated traces have only one process that never frees
@@ -9,9 +11,8 @@
  */
 int rr_evict(void)
 {
-	static int i = 0;
-	int victim = i;
-	i = (i + 1) % memsize;
+	int victim = rr_next;
+	rr_next = (rr_next + 1) % memsize;
 	return victim;
 }
 
@@ -27,9 +28,22 @@ void rr_ref(int frame)
 /* Initialize any data structures needed for this replacement algorithm. */
 void rr_init(void)
 {
+	rr_next = 0;
 }
 
 /* Cleanup any data structures created in rr_init(). */
 void rr_cleanup(void)
 {
 }
+
+/* Save the position of the next victim to a checkpoint. */
+int rr_checkpoint(FILE *f)
+{
+	return ckpt_put(f, &rr_next, sizeof(rr_next));
+}
+
+/* Restore the position saved by rr_checkpoint(). */
+int rr_restore(FILE *f)
+{
+	return ckpt_get(f, &rr_next, sizeof(rr_next));
+}
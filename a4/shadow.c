@@ -0,0 +1,445 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shadow.h"
+#include "trace.h"
+
+//---------------------------------------------------------------------
+// Shadow mode replays one trace with two replacement algorithms side by
+// side and records where they part ways.
+//
+// Each algorithm runs a complete simulation, run_sim(), in a thread of its
+// own, since all simulator state is thread-local. The calling thread parses
+// the trace once, into chunks that both sides replay. There are two chunk
+// buffers: while the sides replay one, the calling thread compares their
+// outcomes for the previous chunk and parses the next chunk into the other
+// buffer. The three threads meet at a barrier between chunks.
+//
+// For every reference a side records whether it hit and which pages it
+// evicted. A reference on which one side hit and the other missed, or on
+// which the two evicted different pages, is a divergence. Divergences are
+// written to the log (-L) as
+//
+//     header: "SIMSHADW", uint32 version, uint32 memsize,
+//             then both algorithm names, each NUL-terminated
+//     record: varint  reference number minus that of the previous record
+//             byte    bit 0 set if the first algorithm hit, bit 1 the second
+//             varint  virtual page number referenced
+//             varint  victims of the first algorithm, then of the second
+//             varint  zigzag(victim page - referenced page), for each victim
+//
+// with references numbered from 1 and the header integers little-endian.
+// Divergences are also counted per region of the address space, to show
+// which parts of the workload the two algorithms disagree on.
+
+#define SHADOW_MAGIC "SIMSHADW"
+#define SHADOW_VERSION 1
+
+#define CHUNK_REFS 4096
+#define REGION_SHIFT 20     // 1 MB regions
+#define TOP_REGIONS 10
+
+// What one side did for each reference of a chunk
+struct side_out {
+	unsigned char hit[CHUNK_REFS];
+	// The victims of reference i are victims[first_victim[i]] up to
+	// victims[first_victim[i + 1]]
+	size_t first_victim[CHUNK_REFS + 1];
+	vaddr_t *victims;
+	size_t nvictims;
+	size_t capacity;
+};
+
+struct chunk {
+	size_t nrefs;       // 0 once the trace is done
+	struct trace_ref refs[CHUNK_REFS];
+	size_t lines[CHUNK_REFS];
+	struct side_out out[2];
+};
+
+struct region {
+	vaddr_t region;     // vaddr >> REGION_SHIFT
+	size_t only_hit[2]; // references only side i hit
+	size_t victims;     // references with the same outcome but other victims
+};
+
+static const char *alg_names[2];
+static struct sim_job jobs[2];
+static struct chunk *chunks;   // two of them
+static pthread_barrier_t barrier;
+
+static FILE *logf;
+static size_t refs_compared;   // references in the chunks compared so far
+static size_t last_logged;     // reference number of the last record
+
+static size_t only_hit[2];
+static size_t victims_differ;
+static struct region *regions; // open addressing on the region number
+static size_t regions_size;
+static size_t regions_used;
+
+// Side of the comparison run by this thread, and the page held in each of
+// its frames (so that a victim frame can be logged as a page)
+static __thread int side;
+static __thread vaddr_t *frame_page;
+static __thread struct side_out *cur_out;
+
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static void put_varint(FILE *f, uint64_t v)
+{
+	while (v >= 0x80) {
+		putc(v | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+static void put_u32(FILE *f, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) {
+		putc(v >> (8 * i), f);
+	}
+}
+
+static size_t hash_region(vaddr_t region, size_t size)
+{
+	return (size_t)((region * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static struct region *find_region(vaddr_t region)
+{
+	if (2 * (regions_used + 1) > regions_size) {
+		struct region *old = regions;
+		size_t old_size = regions_size;
+		regions_size = regions_size ? 2 * regions_size : 256;
+		regions = calloc(regions_size, sizeof(struct region));
+		for (size_t i = 0; i < old_size; i++) {
+			if (old[i].only_hit[0] + old[i].only_hit[1] + old[i].victims) {
+				size_t j = hash_region(old[i].region, regions_size);
+				while (regions[j].only_hit[0] + regions[j].only_hit[1] + regions[j].victims) {
+					j = (j + 1) & (regions_size - 1);
+				}
+				regions[j] = old[i];
+			}
+		}
+		free(old);
+	}
+
+	size_t i = hash_region(region, regions_size);
+	for (;; i = (i + 1) & (regions_size - 1)) {
+		struct region *r = &regions[i];
+		if (r->only_hit[0] + r->only_hit[1] + r->victims == 0) {
+			// Empty; the caller counts the divergence right away
+			r->region = region;
+			regions_used += 1;
+			return r;
+		}
+		if (r->region == region) {
+			return r;
+		}
+	}
+}
+
+static int cmp_vaddr(const void *a, const void *b)
+{
+	vaddr_t x = *(const vaddr_t *)a, y = *(const vaddr_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Returns true if the two sides evicted the same pages for reference i.
+ * The order within a batch does not matter. */
+static bool same_victims(struct side_out *a, struct side_out *b, size_t i)
+{
+	size_t na = a->first_victim[i + 1] - a->first_victim[i];
+	size_t nb = b->first_victim[i + 1] - b->first_victim[i];
+	vaddr_t *va = &a->victims[a->first_victim[i]];
+	vaddr_t *vb = &b->victims[b->first_victim[i]];
+
+	if (na != nb) {
+		return false;
+	}
+	if (na > 1) {
+		qsort(va, na, sizeof(vaddr_t), cmp_vaddr);
+		qsort(vb, nb, sizeof(vaddr_t), cmp_vaddr);
+	}
+	return memcmp(va, vb, na * sizeof(vaddr_t)) == 0;
+}
+
+static void log_divergence(const struct chunk *c, size_t i, size_t ref_number)
+{
+	vaddr_t vpn = c->refs[i].vaddr >> PAGE_SHIFT;
+
+	put_varint(logf, ref_number - last_logged);
+	putc(c->out[0].hit[i] | c->out[1].hit[i] << 1, logf);
+	put_varint(logf, vpn);
+	for (int s = 0; s < 2; s++) {
+		put_varint(logf, c->out[s].first_victim[i + 1] - c->out[s].first_victim[i]);
+	}
+	for (int s = 0; s < 2; s++) {
+		const struct side_out *out = &c->out[s];
+		for (size_t v = out->first_victim[i]; v < out->first_victim[i + 1]; v++) {
+			put_varint(logf, zigzag(out->victims[v] - vpn));
+		}
+	}
+	last_logged = ref_number;
+}
+
+/* Compares what the two sides did for each reference of a replayed chunk */
+static void compare_chunk(struct chunk *c)
+{
+	struct side_out *a = &c->out[0];
+	struct side_out *b = &c->out[1];
+
+	for (size_t i = 0; i < c->nrefs; i++) {
+		// Most references evict nothing on either side
+		bool no_victims = a->first_victim[i] == a->first_victim[i + 1] &&
+		                  b->first_victim[i] == b->first_victim[i + 1];
+		if (a->hit[i] == b->hit[i] && (no_victims || same_victims(a, b, i))) {
+			continue;
+		}
+
+		struct region *r = find_region(c->refs[i].vaddr >> REGION_SHIFT);
+		if (a->hit[i] != b->hit[i]) {
+			int s = b->hit[i];
+			only_hit[s] += 1;
+			r->only_hit[s] += 1;
+		} else {
+			victims_differ += 1;
+			r->victims += 1;
+		}
+		if (logf) {
+			log_divergence(c, i, refs_compared + i + 1);
+		}
+	}
+	refs_compared += c->nrefs;
+}
+
+/* Fills c with the next references of the trace, unless *done is set, and
+ * sets *done once the trace is exhausted. Returns 0 on success and -1 if the
+ * trace is invalid or unreadable. */
+static int fill_chunk(struct trace_reader *t, struct chunk *c, bool *done)
+{
+	int ret = 1;
+
+	c->nrefs = 0;
+	while (!*done && c->nrefs < CHUNK_REFS &&
+	       (ret = trace_next(t, &c->refs[c->nrefs])) > 0) {
+		c->lines[c->nrefs++] = trace_linenum(t);
+	}
+	if (ret <= 0) {
+		*done = true;
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+static void shadow_victim(int frame)
+{
+	struct side_out *out = cur_out;
+	if (out->nvictims == out->capacity) {
+		out->capacity = out->capacity ? 2 * out->capacity : CHUNK_REFS;
+		out->victims = realloc(out->victims, out->capacity * sizeof(vaddr_t));
+		if (!out->victims) {
+			perror("shadow");
+			exit(1);
+		}
+	}
+	out->victims[out->nvictims++] = frame_page[frame];
+}
+
+/* Replays the shared chunks in the calling side's simulation, which run_sim
+ * has set up. Returns 0. */
+int shadow_replay(void)
+{
+	frame_page = calloc(memsize, sizeof(vaddr_t));
+	victim_func = shadow_victim;
+
+	for (size_t k = 0;; k++) {
+		pthread_barrier_wait(&barrier);
+		struct chunk *c = &chunks[k % 2];
+		if (c->nrefs == 0) {
+			break;
+		}
+
+		cur_out = &c->out[side];
+		cur_out->nvictims = 0;
+		for (size_t i = 0; i < c->nrefs; i++) {
+			const struct trace_ref *ref = &c->refs[i];
+			size_t misses = miss_count;
+
+			cur_out->first_victim[i] = cur_out->nvictims;
+			int frame = access_mem(ref->type, ref->vaddr, ref->val, c->lines[i]);
+			frame_page[frame] = ref->vaddr >> PAGE_SHIFT;
+			cur_out->hit[i] = (miss_count == misses);
+		}
+		cur_out->first_victim[c->nrefs] = cur_out->nvictims;
+	}
+
+	victim_func = NULL;
+	free(frame_page);
+	return 0;
+}
+
+struct side_arg {
+	int side;
+	struct sim_result *res;
+	int status;
+};
+
+static void *side_main(void *arg)
+{
+	struct side_arg *sa = arg;
+	side = sa->side;
+	sa->status = run_sim(&jobs[sa->side], sa->res);
+	return NULL;
+}
+
+/* Runs job->alg and job->shadow_alg over job->tracefile in lockstep, filling
+ * in res[0] and res[1], and logs their divergences to logfile unless it is
+ * NULL. Returns 0 on success, or -1 if the trace could not be opened or
+ * replayed or an algorithm does not exist.
+ */
+int shadow_run(const struct sim_job *job, const char *logfile,
+               struct sim_result res[2])
+{
+	alg_names[0] = job->alg;
+	alg_names[1] = job->shadow_alg;
+	refs_compared = last_logged = 0;
+	only_hit[0] = only_hit[1] = victims_differ = 0;
+
+	// Check the algorithms here, so that a side never fails to reach the
+	// barrier
+	for (int s = 0; s < 2; s++) {
+		if (select_alg(alg_names[s]) != 0) {
+			fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
+			        alg_names[s]);
+			return -1;
+		}
+		jobs[s] = *job;
+		jobs[s].alg = alg_names[s];
+		jobs[s].measure_memory = false;
+		jobs[s].report = false;
+	}
+
+	struct trace_reader *trace = trace_open(job->tracefile);
+	if (!trace) {
+		return -1;
+	}
+	if (logfile) {
+		if (!(logf = fopen(logfile, "wb"))) {
+			perror(logfile);
+			trace_close(trace);
+			return -1;
+		}
+		fwrite(SHADOW_MAGIC, 1, strlen(SHADOW_MAGIC), logf);
+		put_u32(logf, SHADOW_VERSION);
+		put_u32(logf, job->memsize);
+		for (int s = 0; s < 2; s++) {
+			fwrite(alg_names[s], 1, strlen(alg_names[s]) + 1, logf);
+		}
+	}
+
+	chunks = calloc(2, sizeof(struct chunk));
+	pthread_barrier_init(&barrier, NULL, 3);
+	bool done = false;
+	int ret = fill_chunk(trace, &chunks[0], &done);
+
+	pthread_t threads[2];
+	struct side_arg args[2];
+	for (int s = 0; s < 2; s++) {
+		args[s] = (struct side_arg){ s, &res[s], 0 };
+		pthread_create(&threads[s], NULL, side_main, &args[s]);
+	}
+
+	// Chunk k is replayed after the kth barrier; meanwhile chunk k - 1 is
+	// compared and chunk k + 1 read into its buffer
+	for (size_t k = 0;; k++) {
+		pthread_barrier_wait(&barrier);
+		if (k > 0) {
+			compare_chunk(&chunks[(k - 1) % 2]);
+		}
+		if (chunks[k % 2].nrefs == 0) {
+			break;
+		}
+		if (fill_chunk(trace, &chunks[(k + 1) % 2], &done) != 0) {
+			ret = -1;
+		}
+	}
+
+	for (int s = 0; s < 2; s++) {
+		pthread_join(threads[s], NULL);
+		if (args[s].status != 0) {
+			ret = -1;
+		}
+		free(chunks[0].out[s].victims);
+		free(chunks[1].out[s].victims);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(chunks);
+	trace_close(trace);
+	if (logf && fclose(logf) != 0) {
+		perror(logfile);
+		ret = -1;
+	}
+	logf = NULL;
+	return ret;
+}
+
+static int cmp_regions(const void *a, const void *b)
+{
+	const struct region *x = a, *y = b;
+	size_t nx = x->only_hit[0] + x->only_hit[1] + x->victims;
+	size_t ny = y->only_hit[0] + y->only_hit[1] + y->victims;
+	if (nx != ny) {
+		return nx < ny ? 1 : -1;
+	}
+	return x->region < y->region ? -1 : x->region > y->region;
+}
+
+/* Prints the number of divergences and the regions with the most of them,
+ * and frees the region table. */
+void shadow_report(void)
+{
+	size_t total = only_hit[0] + only_hit[1] + victims_differ;
+
+	printf("\n");
+	printf("Shadow comparison of %s and %s over %zu references:\n",
+	       alg_names[0], alg_names[1], refs_compared);
+	printf("Only %s hit: %zu\n", alg_names[0], only_hit[0]);
+	printf("Only %s hit: %zu\n", alg_names[1], only_hit[1]);
+	printf("Same outcome, other victims: %zu\n", victims_differ);
+
+	// Compact the table and sort it by divergences
+	size_t n = 0;
+	for (size_t i = 0; i < regions_size; i++) {
+		if (regions[i].only_hit[0] + regions[i].only_hit[1] + regions[i].victims) {
+			regions[n++] = regions[i];
+		}
+	}
+	qsort(regions, n, sizeof(struct region), cmp_regions);
+
+	if (n > 0) {
+		printf("Divergence by %d KB region (top %zu of %zu):\n",
+		       1 << (REGION_SHIFT - 10), n < TOP_REGIONS ? n : TOP_REGIONS, n);
+		printf("  %-18s %12s %12s %12s %7s\n", "region",
+		       "only first", "only second", "victims", "share");
+	}
+	for (size_t i = 0; i < n && i < TOP_REGIONS; i++) {
+		const struct region *r = &regions[i];
+		size_t count = r->only_hit[0] + r->only_hit[1] + r->victims;
+		printf("  0x%016lx %12zu %12zu %12zu %6.2f%%\n",
+		       r->region << REGION_SHIFT, r->only_hit[0], r->only_hit[1],
+		       r->victims, 100.0 * count / total);
+	}
+
+	free(regions);
+	regions = NULL;
+	regions_size = regions_used = 0;
+}
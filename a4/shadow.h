@@ -0,0 +1,16 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include "sim.h"
+
+
+// Shadow mode: replay one trace with two algorithms in lockstep (-S) and
+// log the references on which they diverge
+
+int shadow_run(const struct sim_job *job, const char *logfile,
+               struct sim_result res[2]);
+int shadow_replay(void);
+void shadow_report(void);
+
+
+#endif /* __SHADOW_H__ */
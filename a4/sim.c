@@ -9,14 +9,41 @@
 #include "sim.h"
 #include "pagetable_generic.h"
 #include "swap.h"
+#include "analysis.h"
+#include "batch.h"
+#include "checkpoint.h"
+#include "policy.h"
+#include "multicore.h"
+#include "trace.h"
+#include "shadow.h"
+#include "region.h"
 
 
 // Define global variables declared in sim.h
-size_t memsize = 0;
-bool debug = false;
-unsigned char *physmem = NULL;
-struct frame *coremap = NULL;
-char *tracefile = NULL;
+size_t simpagesize = DEFAULT_SIMPAGESIZE;
+__thread size_t memsize = 0;
+__thread bool debug = false;
+__thread unsigned char *physmem = NULL;
+__thread struct frame *coremap = NULL;
+__thread size_t *frame_last_use = NULL;
+__thread char *tracefile = NULL;
+
+/* Latency model used to estimate the cost of a run, in nanoseconds per event.
+ * The defaults are in the ballpark of a DRAM access, a zero-fill page fault
+ * and a read or write of one page on an SSD. */
+static struct {
+	double hit;        // every reference that finds its page resident
+	double minor;      // fault on a new page, zero-filled by init_frame
+	double major;      // fault on a page read back in by swap_pagein
+	double writeback;  // dirty page written out by swap_pageout
+} latency = { 100.0, 2000.0, 80000.0, 100000.0 };
+
+// Number of hottest pages to report in the workload analysis; 0 if off
+static size_t analysis_top_n = 0;
+static bool analysis_on = false;
+
+// Address ranges file or "auto" for per-region statistics; NULL if off
+static const char *region_spec = NULL;
 
 
 /* 
@@ -65,33 +92,42 @@ get_bytes_used(struct mallinfo *start_mallinfo)
 
 
 /* Each eviction algorithm is represented by a structure with its name
- * and three functions.
+ * and its functions. evict_batch and report are optional; algorithms that
+ * leave evict_batch NULL have evict called repeatedly when a batch of victims
+ * is needed.
  */
-struct functions {
-	const char *name;         // String name of eviction algorithm
-	void (*init)(void);       // Initialize any data needed by alg
-	void (*cleanup)(void);    // Cleanup any data initialized in init()
-	void (*ref)(int);	  // Called on each reference
-	int (*evict)(void);       // Called to choose victim for eviction
-};
-
 /* The algs array gives us a mapping between the name of an eviction
  * algorithm as given in a command line argument, and the function to
- * call to select the victim page.
+ * call to select the victim page. Policies loaded from shared objects
+ * (-a plugin:path.so) use the same interface; see policy.h.
  */
-static struct functions algs[] = {
-	{ "rand", rand_init, rand_cleanup, rand_ref, rand_evict },
-	{ "rr", rr_init, rr_cleanup, rr_ref, rr_evict },
-	{ "clock", clock_init, clock_cleanup, clock_ref, clock_evict },
-	{ "lru", lru_init, lru_cleanup, lru_ref, lru_evict },
+static const struct sim_policy algs[] = {
+	{ SIM_POLICY_VERSION, "rand", rand_init, rand_cleanup, rand_ref, rand_evict,
+	  NULL, NULL, rand_checkpoint, rand_restore },
+	{ SIM_POLICY_VERSION, "rr", rr_init, rr_cleanup, rr_ref, rr_evict,
+	  NULL, NULL, rr_checkpoint, rr_restore },
+	{ SIM_POLICY_VERSION, "clock", clock_init, clock_cleanup, clock_ref, clock_evict,
+	  clock_evict_batch, NULL, clock_checkpoint, clock_restore },
+	{ SIM_POLICY_VERSION, "lru", lru_init, lru_cleanup, lru_ref, lru_evict,
+	  lru_evict_batch, NULL, lru_checkpoint, lru_restore },
+	{ SIM_POLICY_VERSION, "ws", ws_init, ws_cleanup, ws_ref, ws_evict,
+	  ws_evict_batch, ws_report, ws_checkpoint, ws_restore },
+	{ SIM_POLICY_VERSION, "wsclock", wsclock_init, wsclock_cleanup, wsclock_ref, wsclock_evict,
+	  NULL, ws_report, wsclock_checkpoint, wsclock_restore },
+	{ SIM_POLICY_VERSION, "aging", aging_init, aging_cleanup, aging_ref, aging_evict,
+	  aging_evict_batch, NULL, aging_checkpoint, aging_restore },
 };
 static size_t num_algs = sizeof(algs) / sizeof(algs[0]);
 
-static void (*init_func)() = NULL;
-static void (*cleanup_func)() = NULL;
+static __thread void (*init_func)() = NULL;
+static __thread void (*cleanup_func)() = NULL;
+static __thread void (*report_func)() = NULL;
 
-void (*ref_func)(int) = NULL;
-int (*evict_func)() = NULL;
+__thread void (*ref_func)(int) = NULL;
+__thread int (*evict_func)() = NULL;
+__thread size_t (*evict_batch_func)(int *, size_t) = NULL;
+__thread int (*checkpoint_func)(FILE *) = NULL;
+__thread int (*restore_func)(FILE *) = NULL;
 
 
 /* An actual memory access based on the vaddr from the trace file.
@@ -106,9 +142,9 @@ int (*evict_func)() = NULL;
  *
  * We then check that the memory has the expected content (just a copy of the
  * virtual address) and, in case of a write reference, increment the version
- * counter.
+ * counter. Returns the frame that holds the page.
  */
-static void access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum)
+int access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum)
 {
 	unsigned char *pgptr; 
 	unsigned char *memptr;
@@ -126,143 +162,438 @@ static void access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linen
 			       linenum, *memptr, val);
 		}
 	}
+	return (pgptr - physmem) / simpagesize;
 }
 
-static void replay_trace(FILE *f)
+/* Replays the trace from its current position. If the job asks for
+ * checkpoints, one is written every checkpoint_interval references.
+ * Returns 0 on success, or -1 if the trace is invalid or unreadable.
+ */
+static int replay_trace(struct trace_reader *t, const struct sim_job *job)
 {
-	char line[256];
-	size_t linenum = 0;
-	while (fgets(line, sizeof(line), f)) {
-		++linenum;
-		if (line[0] == '=') {
-			continue;
+	struct trace_ref ref;
+	int ret;
+
+	while ((ret = trace_next(t, &ref)) > 0) {
+		if (debug) {			
+			printf("%c %lx %hhu\n", ref.type, ref.vaddr, ref.val);
+		}
+		if (analysis_on) {
+			analysis_ref(ref.vaddr, ref.type);
+		}
+		
+		size_t misses = miss_count;
+		int frame = access_mem(ref.type, ref.vaddr, ref.val, trace_linenum(t));
+		if (region_spec) {
+			region_ref(ref.vaddr, ref.type, frame, miss_count == misses);
 		}
 
-		vaddr_t vaddr;
-		char type;
-		unsigned char val;
-		if (sscanf(line, "%c %zx %hhu", &type, &vaddr, &val) != 3) {
-			fprintf(stderr, "Invalid trace line %zu: %s\n",
-				linenum, line);
-			exit(1);
+		if (job->checkpoint_interval &&
+		    ref_count % job->checkpoint_interval == 0) {
+			if (checkpoint_save(job->checkpoint_file, job, trace_tell(t),
+			                    trace_linenum(t)) != 0) {
+				fprintf(stderr, "Warning: checkpoint at trace line %zu failed\n",
+				        trace_linenum(t));
+			}
 		}
-		if (type != 'I' && type != 'L' && type != 'S' && type != 'M') {
-			fprintf(stderr,"Invalid reftype, line %zu: %s\n",
-				linenum, line);
-			exit(1);
+	}
+	return ret;
+}
+
+/* Installs the functions of the named replacement algorithm, which is
+ * either built in or "plugin:" followed by the path of a shared object.
+ * Returns 0 on success, or -1 if there is no such algorithm.
+ */
+int select_alg(const char *name)
+{
+	const struct sim_policy *policy = NULL;
+
+	if (strncmp(name, SIM_POLICY_PREFIX, strlen(SIM_POLICY_PREFIX)) == 0) {
+		policy = policy_load(name + strlen(SIM_POLICY_PREFIX));
+	}
+	for (size_t i = 0; i < num_algs && !policy; ++i) {
+		if (strcmp(algs[i].name, name) == 0) {
+			policy = &algs[i];
 		}
-		if ((vaddr % PAGE_SIZE) > SIMPAGESIZE) {
-			fprintf(stderr,"Invalid vaddr, offset must be in range of simulated page frame size, line %zu: %s\n",
-				linenum, line);
+	}
+	if (!policy) {
+		return -1;
+	}
+
+	init_func = policy->init;
+	cleanup_func = policy->cleanup;
+	ref_func = policy->ref;
+	evict_func = policy->evict;
+	evict_batch_func = policy->evict_batch;
+	report_func = policy->report;
+	checkpoint_func = policy->checkpoint;
+	restore_func = policy->restore;
+	return 0;
+}
+
+/* Runs one simulation in the calling thread and fills in res.
+ * Returns 0 on success, or -1 if the trace could not be opened or replayed
+ * or the algorithm does not exist.
+ */
+int run_sim(const struct sim_job *job, struct sim_result *res)
+{
+	struct mallinfo start_mallinfo;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	if (select_alg(job->alg) != 0) {
+		fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
+				job->alg);
+		return -1;
+	}
+
+	// In multi-core mode each CPU thread opens its own trace, and in shadow
+	// mode the trace is read by shadow_run()
+	struct trace_reader *trace = NULL;
+	if (!job->multicore && !job->shadow_alg &&
+	    !(trace = trace_open(job->tracefile))) {
+		return -1;
+	}
+	tracefile = (char *)job->tracefile;
+	memsize = job->memsize;
+	evict_batch_size = job->evict_batch < memsize ? job->evict_batch : memsize;
+	ws_tau = job->ws_tau;
+	aging_interval = job->aging_interval;
+
+	// Initialize main data structures for simulation.
+	// This happens before calling the replacement algorithm init function
+	// so that the init_func can refer to the coremap if needed.
+	//coremap = calloc(memsize, sizeof(struct frame));
+	//physmem = calloc(memsize, simpagesize);
+	coremap = malloc(memsize * sizeof(struct frame));
+	frame_last_use = malloc(memsize * sizeof(size_t));
+	// Page-aligned, so that frames can be the source and target of
+	// direct I/O to the swapfile
+	size_t physmem_size = (memsize * simpagesize + PAGE_SIZE - 1) & PAGE_MASK;
+	physmem = aligned_alloc(PAGE_SIZE, physmem_size);
+	swap_init(job->swapsize, job->direct_swap);
+
+	if (job->measure_memory) {
+		start_mallinfo = mallinfo();
+	}
+	double starttime = get_time();
+	// Call pagetable and replacement algorithm's init_func before
+	// replaying trace.
+	init_pagetable();
+	init_func();
+	if (job->resume) {
+		size_t linenum;
+		long pos;
+		if (checkpoint_load(job->checkpoint_file, job, &pos, &linenum) != 0 ||
+		    trace_resume(trace, pos, linenum) != 0) {
+			fprintf(stderr, "Error: cannot resume from %s\n", job->checkpoint_file);
 			exit(1);
 		}
-		if (debug) {			
-			printf("%c %lx %hhu\n", type, vaddr, val);
-		}
-		
-		access_mem(type, vaddr, val, linenum);
+	}
+	if (job->multicore) {
+		ret = mc_replay(job);
+	} else if (job->shadow_alg) {
+		ret = shadow_replay();
+	} else {
+		ret = replay_trace(trace, job);
+	}
+	res->time = get_time() - starttime;
+	if (job->measure_memory) {
+		res->bytes_used = get_bytes_used(&start_mallinfo);
+	}
+	
+	if (debug) {
+		print_pagetable();
+	}
+	if (job->report && report_func) {
+		report_func();
+	}
+	cleanup_func();
+
+	// Cleanup data structures and remove temporary swapfile
+	free(coremap);
+	free(frame_last_use);
+	free(physmem);
+	swap_usage(&res->swap_slots_peak, &res->swap_slots_size);
+	swap_io_stats(&res->swap_in, &res->swap_out);
+	swap_destroy();
+	free_pagetable();
+	if (trace) {
+		trace_close(trace);
+	}
+
+	res->hit_count = hit_count;
+	res->miss_count = miss_count;
+	res->ref_count = ref_count;
+	res->evict_clean_count = evict_clean_count;
+	res->evict_dirty_count = evict_dirty_count;
+	res->minor_fault_count = minor_fault_count;
+	res->major_fault_count = major_fault_count;
+	res->evict_batch_count = evict_batch_count;
+	res->evict_batch_max = evict_batch_max;
+	res->swap_write_count = swap_write_count;
+	res->swap_write_saved = swap_write_saved;
+	res->clean_writeback_count = clean_writeback_count;
+	res->walk_count = walk_count;
+	res->walk_cache_hit_count = walk_cache_hit_count;
+
+	// Faults pay for the page access itself on top of the fault handling
+	res->stall_ns = minor_fault_count * latency.minor +
+	                major_fault_count * latency.major +
+	                (evict_dirty_count + clean_writeback_count) * latency.writeback;
+	double total_ns = ref_count * latency.hit + res->stall_ns;
+	res->amat_ns = ref_count ? total_ns / ref_count : 0.0;
+
+	return ret;
+}
+
+static void print_swap_io(const char *what, const struct swap_io_stats *st)
+{
+	printf("%s: %zu ops, %.3f MB", what, st->ops, st->bytes / 1e6);
+	if (st->ops > 0) {
+		printf(", %.2f MB/s, latency p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us",
+		       st->seconds > 0 ? st->bytes / 1e6 / st->seconds : 0.0,
+		       st->p50_us, st->p90_us, st->p99_us, st->max_us);
+	}
+	printf("\n");
+}
+
+// Prints the results of a simulation, and the memory it used if that was
+// measured
+static void print_summary(const struct sim_result *res, bool show_memory)
+{
+	printf("\n");
+	printf("Hit count: %zu\n", res->hit_count);
+	printf("Miss count: %zu\n", res->miss_count);
+	printf("Clean evictions: %zu\n", res->evict_clean_count);
+	printf("Dirty evictions: %zu\n", res->evict_dirty_count);
+	printf("Eviction batches: %zu (avg size %.2f, max %zu)\n",
+	       res->evict_batch_count,
+	       res->evict_batch_count ? (double)(res->evict_clean_count + res->evict_dirty_count) / res->evict_batch_count : 0.0,
+	       res->evict_batch_max);
+	printf("Swap write ops: %zu (%zu saved by clustering)\n",
+	       res->swap_write_count, res->swap_write_saved);
+	printf("Write-backs without eviction: %zu\n", res->clean_writeback_count);
+	printf("Swap slots: %zu peak in use, %zu in swapfile\n",
+	       res->swap_slots_peak, res->swap_slots_size);
+	print_swap_io("Swap reads", &res->swap_in);
+	print_swap_io("Swap writes", &res->swap_out);
+	printf("Total references: %zu\n", res->ref_count);
+	printf("Hit rate: %.4f\n", ((double)res->hit_count / res->ref_count) * 100.0);
+	printf("Miss rate: %.4f\n", ((double)res->miss_count / res->ref_count) * 100.0);
+	printf("Minor faults: %zu\n", res->minor_fault_count);
+	printf("Major faults: %zu\n", res->major_fault_count);
+	printf("Page walk cache hits: %zu of %zu walks (%.2f%%)\n",
+	       res->walk_cache_hit_count, res->walk_count,
+	       res->walk_count ? 100.0 * res->walk_cache_hit_count / res->walk_count : 0.0);
+	printf("Modeled stall time: %.3f ms\n", res->stall_ns / 1000000.0);
+	printf("AMAT: %.2f ns\n", res->amat_ns);
+
+	printf("Time to run simulation: %f\n", res->time);
+	if (show_memory) {
+		printf("Memory used by simulation: %lu bytes\n", res->bytes_used);
 	}
 }
 
 
 int main(int argc, char *argv[])
 {
-	size_t swapsize = 0;
-	char *replacement_alg = NULL;
-	double starttime;
-	double endtime;
-	struct mallinfo start_mallinfo;
-	unsigned long bytes_used;       
-	const char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm\n";
+	struct sim_job job = {
+		.evict_batch = 1,
+		.ws_tau = 1000,
+		.aging_interval = 100,
+		.measure_memory = true,
+		.report = true,
+	};
+	struct sim_result res;
+	const char *batch = NULL;
+	const char *csvfile = NULL;
+	const char *shadow_log = NULL;
+	size_t nworkers = 0;
+	const char *usage = "USAGE: sim -f tracefile|- -m memorysize [-s swapsize] -a algorithm|plugin:file.so [-b evictbatch] [-t tau] [-g agingtick]\n"
+	                    "           [-p framesize] [-D]\n"
+	                    "           [-A toppages] [-r auto|rangesfile] [-c hit,minor,major,writeback (ns)]\n"
+	                    "           [-k checkpointfile [-C interval] [-R]] [-S shadowalgorithm [-L divergencelog]]\n"
+	                    "       sim -M -f cpu0trace,cpu1trace,... -m memorysize [-s swapsize] -a algorithm [-b evictbatch]\n"
+	                    "       sim -B tracedir|manifest [-j workers] [-o results.csv] [-m memorysize [-s swapsize] -a alg[,alg...]]\n";
 
 	int opt;
-	while ((opt = getopt(argc, argv, "f:m:a:s:")) != -1) {
+	while ((opt = getopt(argc, argv, "f:m:a:s:b:t:g:p:DA:r:c:B:j:o:k:C:RMS:L:")) != -1) {
 		switch (opt) {
 		case 'f':
-			tracefile = optarg;
+			job.tracefile = optarg;
 			break;
 		case 'm':
-			memsize = strtoul(optarg, NULL, 10);
+			job.memsize = strtoul(optarg, NULL, 10);
 			break;
 		case 'a':
-			replacement_alg = optarg;
+			job.alg = optarg;
 			break;
 		case 's':
-			swapsize = strtoul(optarg, NULL, 10);
+			job.swapsize = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			job.evict_batch = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			job.ws_tau = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			job.aging_interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			simpagesize = strtoul(optarg, NULL, 10);
+			break;
+		case 'D':
+			job.direct_swap = true;
+			break;
+		case 'k':
+			job.checkpoint_file = optarg;
+			break;
+		case 'C':
+			job.checkpoint_interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			job.resume = true;
+			break;
+		case 'M':
+			job.multicore = true;
+			break;
+		case 'S':
+			job.shadow_alg = optarg;
+			break;
+		case 'L':
+			shadow_log = optarg;
+			break;
+		case 'c':
+			if (sscanf(optarg, "%lf,%lf,%lf,%lf", &latency.hit,
+			           &latency.minor, &latency.major,
+			           &latency.writeback) != 4) {
+				fprintf(stderr, "%s", usage);
+				return 1;
+			}
+			break;
+		case 'A':
+			analysis_on = true;
+			analysis_top_n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			region_spec = optarg;
+			break;
+		case 'B':
+			batch = optarg;
+			break;
+		case 'j':
+			nworkers = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			csvfile = optarg;
 			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			return 1;
 		}
 	}
-	if (!tracefile || !memsize || !swapsize || !replacement_alg) {
-		fprintf(stderr, "%s", usage);
+	if (job.evict_batch < 1 || job.evict_batch > MAX_EVICT_BATCH ||
+	    (job.memsize && job.evict_batch > job.memsize)) {
+		fprintf(stderr, "Error: eviction batch must be between 1 and %d, "
+		        "and no larger than memorysize\n", MAX_EVICT_BATCH);
 		return 1;
 	}
 
-	FILE *tfp = fopen(tracefile, "r");
-	if (!tfp) {
-		perror(tracefile);
+	if (simpagesize == 0 || simpagesize > MAX_SIMPAGESIZE ||
+	    (simpagesize & (simpagesize - 1)) != 0) {
+		fprintf(stderr, "Error: frame size must be a power of two no larger than %d\n",
+		        MAX_SIMPAGESIZE);
+		return 1;
+	}
+	if (job.direct_swap && simpagesize < SWAP_DIRECT_ALIGN) {
+		fprintf(stderr, "Error: direct swap I/O needs a frame size of at least %d\n",
+		        SWAP_DIRECT_ALIGN);
 		return 1;
 	}
 
-	// Initialize main data structures for simulation.
-	// This happens before calling the replacement algorithm init function
-	// so that the init_func can refer to the coremap if needed.
-	//coremap = calloc(memsize, sizeof(struct frame));
-	//physmem = calloc(memsize, SIMPAGESIZE);
-	coremap = malloc(memsize * sizeof(struct frame));
-	physmem = malloc(memsize * SIMPAGESIZE);
-	swap_init(swapsize);
-
-	for (size_t i = 0; i < num_algs; ++i) {
-		if (strcmp(algs[i].name, replacement_alg) == 0) {
-			init_func = algs[i].init;
-			cleanup_func = algs[i].cleanup;
-			ref_func = algs[i].ref;
-			evict_func = algs[i].evict;
-			break;
+	if (job.ws_tau == 0 || job.aging_interval == 0) {
+		fprintf(stderr, "Error: working set window and aging tick must be at least 1\n");
+		return 1;
+	}
+
+	if (job.multicore && (batch || analysis_on || region_spec || job.checkpoint_file)) {
+		fprintf(stderr, "Error: -M cannot be combined with -B, -A, -r or checkpoints\n");
+		return 1;
+	}
+
+	if (job.shadow_alg &&
+	    (batch || job.multicore || analysis_on || region_spec || job.checkpoint_file)) {
+		fprintf(stderr, "Error: -S cannot be combined with -B, -M, -A, -r or checkpoints\n");
+		return 1;
+	}
+	if (shadow_log && !job.shadow_alg) {
+		fprintf(stderr, "Error: -L needs a shadow algorithm (-S)\n");
+		return 1;
+	}
+
+	if (batch) {
+		if (analysis_on || region_spec) {
+			fprintf(stderr, "Error: -A and -r are not supported in batch mode\n");
+			return 1;
+		}
+		if (job.checkpoint_file) {
+			fprintf(stderr, "Error: checkpoints are not supported in batch mode\n");
+			return 1;
 		}
+		job.measure_memory = false;
+		job.report = false;
+		return run_batch(batch, &job, nworkers, csvfile) == 0 ? 0 : 1;
 	}
-	if (!evict_func) {
-		fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
-				replacement_alg);
+
+	if (!job.tracefile || !job.memsize || !job.alg) {
+		fprintf(stderr, "%s", usage);
 		return 1;
 	}
 
-	start_mallinfo = mallinfo();
-	starttime = get_time();
-	// Call pagetable and replacement algorithm's init_func before
-	// replaying trace.
-	init_pagetable();
-	init_func();
-	replay_trace(tfp);
-	(void)replay_trace;
-	endtime = get_time();
-	bytes_used = get_bytes_used(&start_mallinfo);
-	
-	if (debug) {
-		print_pagetable();
+	if ((job.checkpoint_interval || job.resume) && !job.checkpoint_file) {
+		fprintf(stderr, "Error: -C and -R need a checkpoint file (-k)\n");
+		return 1;
+	}
+	if (job.resume && region_spec) {
+		fprintf(stderr, "Error: -r cannot be used when resuming from a checkpoint\n");
+		return 1;
 	}
-	cleanup_func();
 
-	// Cleanup data structures and remove temporary swapfile
-	free(coremap);
-	free(physmem);
-	swap_destroy();
-	free_pagetable();
+	if (job.shadow_alg) {
+		struct sim_result shadow_res[2];
+		if (shadow_run(&job, shadow_log, shadow_res) != 0) {
+			return 1;
+		}
+		printf("\n[%s]", job.alg);
+		// The two sides run at once, so their memory is not measured
+		print_summary(&shadow_res[0], false);
+		printf("\n[%s]", job.shadow_alg);
+		print_summary(&shadow_res[1], false);
+		shadow_report();
+		return 0;
+	}
 
-	printf("\n");
-	printf("Hit count: %zu\n", hit_count);
-	printf("Miss count: %zu\n", miss_count);
-	printf("Clean evictions: %zu\n", evict_clean_count);
-	printf("Dirty evictions: %zu\n", evict_dirty_count);
-	printf("Total references: %zu\n", ref_count);
-	printf("Hit rate: %.4f\n", ((double)hit_count / ref_count) * 100.0);
-	printf("Miss rate: %.4f\n", ((double)miss_count / ref_count) * 100.0);
-
-	printf("Time to run simulation: %f\n",endtime - starttime);
-	printf("Memory used by simulation: %lu bytes\n", bytes_used);
+	if (analysis_on) {
+		analysis_init(analysis_top_n);
+	}
+	if (region_spec && region_init(region_spec, job.memsize) != 0) {
+		return 1;
+	}
+	if (run_sim(&job, &res) != 0) {
+		return 1;
+	}
+	print_summary(&res, job.measure_memory);
+
+	if (analysis_on) {
+		analysis_print();
+		analysis_destroy();
+	}
+	if (region_spec) {
+		region_print();
+		region_destroy();
+	}
 	
 	return 0;
 }
@@ -1,28 +1,114 @@
 #ifndef __SIM_H__
 #define __SIM_H__
 
+#include <stdio.h>
 #include "timer.h"
 #include "pagetable_generic.h"
 
 
-/* Simulated physical memory page frame size */
-#define SIMPAGESIZE 16
+/* Default simulated physical memory page frame size. It can be set (-p) to
+ * any power of two up to the real page size. */
+#define DEFAULT_SIMPAGESIZE 16
+#define MAX_SIMPAGESIZE 4096
 
-extern size_t memsize;
-extern bool debug;
+/* Largest number of victims reclaimed at once (bounded by IOV_MAX) */
+#define MAX_EVICT_BATCH 1024
 
-extern size_t hit_count;
-extern size_t miss_count;
-extern size_t ref_count;
-extern size_t evict_clean_count;
-extern size_t evict_dirty_count;
+/* Simulated page frame size, the same for every simulation in the process */
+extern size_t simpagesize;
+
+/* All simulator state is thread-local, so that batch mode can run several
+ * simulations at once, one in each worker thread. */
+extern __thread size_t memsize;
+extern __thread bool debug;
+
+extern __thread size_t hit_count;
+extern __thread size_t miss_count;
+extern __thread size_t ref_count;
+extern __thread size_t evict_clean_count;
+extern __thread size_t evict_dirty_count;
+extern __thread size_t minor_fault_count;
+extern __thread size_t major_fault_count;
+extern __thread size_t evict_batch_count;
+extern __thread size_t evict_batch_max;
+extern __thread size_t swap_write_count;
+extern __thread size_t swap_write_saved;
+extern __thread size_t clean_writeback_count;
+extern __thread size_t walk_count;
+extern __thread size_t walk_cache_hit_count;
+
+extern __thread size_t evict_batch_size;
 
 /* We simulate physical memory with a large array of bytes */
-extern unsigned char *physmem;
+extern __thread unsigned char *physmem;
+
+extern __thread void (*ref_func)(int frame);
+extern __thread int (*evict_func)(void);
+extern __thread size_t (*evict_batch_func)(int *frames, size_t n);
+extern __thread int (*checkpoint_func)(FILE *f);
+extern __thread int (*restore_func)(FILE *f);
+extern __thread void (*shootdown_func)(int frame);
+extern __thread void (*victim_func)(int frame);
+
+extern __thread char *tracefile;// for opt
+
+/* One simulation run: a trace replayed with one algorithm and configuration */
+struct sim_job {
+	const char *tracefile;
+	const char *alg;
+	size_t memsize;
+	size_t swapsize;
+	size_t evict_batch;
+	size_t ws_tau;        // working set window for ws and wsclock
+	size_t aging_interval; // references between aging counter updates
+	const char *checkpoint_file;
+	size_t checkpoint_interval; // references between checkpoints, 0 for none
+	bool resume;          // start from the checkpoint in checkpoint_file
+	bool measure_memory;  // only meaningful when one simulation runs at a time
+	bool report;          // print algorithm-specific statistics
+	bool multicore;       // tracefile lists one trace per simulated CPU
+	const char *shadow_alg; // replayed in lockstep with alg, or NULL
+	bool direct_swap;     // bypass the page cache for swap I/O (O_DIRECT)
+};
+
+/* Swap I/O in one direction, as seen by the simulator. Latencies are wall
+ * clock time per read or write call, which may cover several pages. */
+struct swap_io_stats {
+	size_t ops;
+	size_t bytes;
+	double seconds;       // total time spent in the calls
+	double p50_us;
+	double p90_us;
+	double p99_us;
+	double max_us;
+};
 
-extern void (*ref_func)(int frame);
-extern int (*evict_func)(void);
+struct sim_result {
+	size_t hit_count;
+	size_t miss_count;
+	size_t ref_count;
+	size_t evict_clean_count;
+	size_t evict_dirty_count;
+	size_t minor_fault_count;
+	size_t major_fault_count;
+	size_t evict_batch_count;
+	size_t evict_batch_max;
+	size_t swap_write_count;
+	size_t swap_write_saved;
+	size_t clean_writeback_count;
+	size_t swap_slots_peak;
+	size_t swap_slots_size;
+	size_t walk_count;
+	size_t walk_cache_hit_count;
+	struct swap_io_stats swap_in;
+	struct swap_io_stats swap_out;
+	double stall_ns;      // from the latency model
+	double amat_ns;
+	double time;          // CPU time to run the simulation, in seconds
+	unsigned long bytes_used;
+};
 
-extern char *tracefile;// for opt
+int run_sim(const struct sim_job *job, struct sim_result *res);
+int select_alg(const char *name);
 
 #endif /* __SIM_H__ */
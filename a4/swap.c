@@ -1,19 +1,25 @@
+#define _GNU_SOURCE // for O_DIRECT and mkostemp
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "pagetable_generic.h"
 #include "sim.h"
 #include "swap.h"
+#include "checkpoint.h"
 
 //---------------------------------------------------------------------
 // Bitmap definitions and functions to manage space in swapfile.
-// We create a fixed-size swapfile, although it could be made larger
-// on demand with a little effort.
+// The swapfile starts at the size given with -s and is made larger on
+// demand, in extents of at least SWAP_EXTENT slots, when it fills up.
 //
 // The bitmap code is modified from the OS/161 bitmap functions.
 
@@ -34,7 +40,7 @@ static int bitmap_init(struct bitmap *b, size_t nbits)
 {
 	size_t nwords = nwords_for_nbits(nbits);
 	b->words = malloc(nwords * sizeof(size_t));
-	if (!b->words) {
+	if (!b->words && nwords > 0) {
 		return -1;
 	}
 
@@ -79,23 +85,257 @@ static int bitmap_alloc(struct bitmap *b, size_t *index)
 	return -1;
 }
 
+// Extend the bitmap to nbits, which must be a multiple of bits_per_word.
+// The new bits are unused, as are the leftover bits at the end of the old
+// last word that bitmap_init() marked in use.
+// Returns 0 on success and -1 if memory could not be allocated.
+static int bitmap_grow(struct bitmap *b, size_t nbits)
+{
+	size_t old_nwords = nwords_for_nbits(b->nbits);
+	size_t nwords = nwords_for_nbits(nbits);
+
+	assert(nbits > b->nbits && nbits % bits_per_word == 0);
+	size_t *words = realloc(b->words, nwords * sizeof(size_t));
+	if (!words) {
+		return -1;
+	}
+	memset(words + old_nwords, 0, (nwords - old_nwords) * sizeof(size_t));
+
+	size_t overbits = b->nbits % bits_per_word;
+	if (overbits > 0) {
+		words[old_nwords - 1] &= ((size_t)1 << overbits) - 1;
+	}
+
+	b->words = words;
+	b->nbits = nbits;
+	return 0;
+}
+
+// Find a run of n consecutive unused bits, mark them all in use and return
+// the index of the first one in *index.
+// Returns 0 on success and -1 if there is no such run.
+static int bitmap_alloc_run(struct bitmap *b, size_t n, size_t *index)
+{
+	size_t run = 0;
+
+	assert(n > 0);
+	for (size_t i = 0; i < b->nbits; ++i) {
+		size_t idx = i / bits_per_word;
+		size_t mask = (size_t)1 << (i % bits_per_word);
+
+		if (b->words[idx] == word_all_bits) {
+			// Skip over a full word at once
+			run = 0;
+			i = (idx + 1) * bits_per_word - 1;
+			continue;
+		}
+		if (b->words[idx] & mask) {
+			run = 0;
+			continue;
+		}
+		if (++run == n) {
+			size_t start = i + 1 - n;
+			for (size_t j = start; j <= i; ++j) {
+				b->words[j / bits_per_word] |= (size_t)1 << (j % bits_per_word);
+			}
+			*index = start;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Marks the bit at the given index as available (0).
+// The bit at the supplied index must be marked allocated.
+static void bitmap_free(struct bitmap *b, size_t index)
+{
+	size_t idx = index / bits_per_word;
+	size_t mask = (size_t)1 << (index % bits_per_word);
+
+	assert(index < b->nbits);
+	assert((b->words[idx] & mask) != 0); // Don't free something not allocated.
+
+	b->words[idx] &= ~mask;
+}
+
 static void bitmap_destroy(struct bitmap *b)
 {
 	free(b->words);
 }
 
+//---------------------------------------------------------------------
+// Swap I/O statistics. Every read and write of the swapfile is timed, and
+// the latencies are kept in a log-linear histogram: one row per power of
+// two of nanoseconds, split into 2^LAT_SUB_BITS equal buckets. A percentile
+// is reported as the low end of its bucket, within 12.5% of the true value.
+
+#define LAT_SUB_BITS 3
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+
+struct io_hist {
+	size_t ops;
+	size_t bytes;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	size_t buckets[LAT_BUCKETS];
+};
+
+static __thread struct io_hist reads;
+static __thread struct io_hist writes;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static size_t lat_bucket(uint64_t ns)
+{
+	if (ns < (1 << LAT_SUB_BITS)) {
+		return ns;
+	}
+	int msb = 63 - __builtin_clzll(ns);
+	size_t sub = (ns >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1);
+	return (size_t)(msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS | sub;
+}
+
+static uint64_t lat_bucket_low(size_t b)
+{
+	if (b < (1 << LAT_SUB_BITS)) {
+		return b;
+	}
+	int msb = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	uint64_t sub = b & ((1 << LAT_SUB_BITS) - 1);
+	return (1ULL << msb) | sub << (msb - LAT_SUB_BITS);
+}
+
+static void io_done(struct io_hist *h, uint64_t start, ssize_t bytes)
+{
+	uint64_t ns = now_ns() - start;
+
+	h->ops += 1;
+	h->bytes += bytes > 0 ? bytes : 0;
+	h->total_ns += ns;
+	if (ns > h->max_ns) {
+		h->max_ns = ns;
+	}
+	h->buckets[lat_bucket(ns)] += 1;
+}
+
+static double io_percentile(const struct io_hist *h, double p)
+{
+	size_t rank = (size_t)(p * h->ops);
+	size_t seen = 0;
+
+	for (size_t b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen > rank) {
+			return lat_bucket_low(b) / 1000.0;
+		}
+	}
+	return h->max_ns / 1000.0;
+}
+
+static void io_summary(const struct io_hist *h, struct swap_io_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	if (h->ops == 0) {
+		return;
+	}
+	st->ops = h->ops;
+	st->bytes = h->bytes;
+	st->seconds = h->total_ns / 1e9;
+	st->p50_us = io_percentile(h, 0.50);
+	st->p90_us = io_percentile(h, 0.90);
+	st->p99_us = io_percentile(h, 0.99);
+	st->max_us = h->max_ns / 1000.0;
+}
+
+// Report the swap reads (page-ins) and writes (page-outs) done so far.
+void swap_io_stats(struct swap_io_stats *in, struct swap_io_stats *out)
+{
+	io_summary(&reads, in);
+	io_summary(&writes, out);
+}
+
 //---------------------------------------------------------------------
 // Swap definitions and functions.
+//
+// With direct I/O the swapfile is opened with O_DIRECT, so page-ins and
+// page-outs go to the device rather than the page cache. O_DIRECT needs
+// buffers, offsets and lengths aligned to the device's logical block size;
+// physmem is page-aligned and slots are frame-sized, so this holds as long
+// as the frame size is at least SWAP_DIRECT_ALIGN.
+
+// Minimum number of slots added to the swapfile each time it fills up
+#define SWAP_EXTENT 4096
+
+static __thread int swapfd;
+static __thread struct bitmap swapmap;
+static __thread char fname[20];
+static __thread size_t slots_used;
+static __thread size_t slots_peak;
+
+// Reserve space in the swap file for every slot in the bitmap.
+static int swap_reserve(void)
+{
+	if (swapmap.nbits == 0) {
+		return 0;
+	}
+	errno = posix_fallocate(swapfd, 0, swapmap.nbits * simpagesize);
+	return errno == 0 ? 0 : -1;
+}
+
+// Make room for at least n more slots by growing the bitmap and the swap
+// file. The swapfile at least doubles each time so that a long run only
+// grows it a logarithmic number of times.
+// Return: 0 on success, -1 on error
+//
+static int swap_grow(size_t n)
+{
+	size_t extent = swapmap.nbits > SWAP_EXTENT ? swapmap.nbits : SWAP_EXTENT;
+	if (extent < n) {
+		extent = n;
+	}
+	size_t nbits = nwords_for_nbits(swapmap.nbits + extent) * bits_per_word;
+
+	if (bitmap_grow(&swapmap, nbits) != 0 || swap_reserve() != 0) {
+		perror("Failed to grow swapfile");
+		return -1;
+	}
+	return 0;
+}
+
+static void slots_taken(size_t n)
+{
+	slots_used += n;
+	if (slots_used > slots_peak) {
+		slots_peak = slots_used;
+	}
+}
+
+// Release the swap slot at 'offset' in the swap file.
+void swap_free(off_t offset)
+{
+	assert(offset != INVALID_SWAP);
+	bitmap_free(&swapmap, offset / simpagesize);
+	slots_used -= 1;
+}
 
-static int swapfd;
-static struct bitmap swapmap;
-static char fname[20];
+// Report the number of swap slots in use at the peak and the number of
+// slots the swapfile has room for now.
+void swap_usage(size_t *peak, size_t *size)
+{
+	*peak = slots_peak;
+	*size = swapmap.nbits;
+}
 
-void swap_init(size_t size)
+void swap_init(size_t size, bool direct)
 {
 	// Initialize the swap file
 	strncpy(fname, "swapfile.XXXXXX", sizeof(fname));
-	if ((swapfd = mkstemp(fname)) == -1) {
+	if ((swapfd = mkostemp(fname, direct ? O_DIRECT : 0)) == -1) {
 		perror("Failed to create temporary file for swap");
 		exit(1);
 	}
@@ -105,6 +345,13 @@ void swap_init(size_t size)
 		perror("Failed to create bitmap for swap\n");
 		exit(1);
 	}
+	if (swap_reserve() != 0) {
+		perror("Failed to reserve space for swap");
+		exit(1);
+	}
+	slots_used = slots_peak = 0;
+	memset(&reads, 0, sizeof(reads));
+	memset(&writes, 0, sizeof(writes));
 }
 
 void swap_destroy(void)
@@ -129,7 +376,7 @@ int swap_pagein(unsigned int frame, off_t offset)
 	assert(offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	void *frame_ptr = &physmem[frame * SIMPAGESIZE];
+	void *frame_ptr = &physmem[frame * simpagesize];
 
 	// Seek to position in swap file where this page was stored
 	off_t pos = lseek(swapfd, offset, SEEK_SET);
@@ -140,8 +387,10 @@ int swap_pagein(unsigned int frame, off_t offset)
 	}
 
 	// Read page data from swapfile into memory
-	ssize_t bytes_read = read(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_read != SIMPAGESIZE) {
+	uint64_t start = now_ns();
+	ssize_t bytes_read = read(swapfd, frame_ptr, simpagesize);
+	io_done(&reads, start, bytes_read);
+	if (bytes_read != (ssize_t)simpagesize) {
 		fprintf(stderr, "swap_pagein: did not read whole page\n");
 		return bytes_read;
 	}
@@ -149,7 +398,8 @@ int swap_pagein(unsigned int frame, off_t offset)
 }
 
 // Write data from (simulated) physical memory 'frame' to 'offset'
-// in swap file. Allocates space in swap file for virtual page if needed.
+// in swap file. Allocates space in swap file for virtual page if needed,
+// growing the swap file when it is full.
 // Input:  frame - the physical frame number (not byte offset in physmem)
 //         offset - the byte position in the swap file
 // Return: the offset where the data was written on success,
@@ -161,16 +411,18 @@ off_t swap_pageout(unsigned int frame, off_t offset)
 	if (offset == INVALID_SWAP) {
 		size_t idx;
 		if (bitmap_alloc(&swapmap, &idx) != 0) {
-			fprintf(stderr, "swap_pageout: Could not allocate space in swapfile. "
-			                "Try running again with a larger swapsize.\n");
-			return INVALID_SWAP;
+			if (swap_grow(1) != 0 || bitmap_alloc(&swapmap, &idx) != 0) {
+				fprintf(stderr, "swap_pageout: Could not allocate space in swapfile.\n");
+				return INVALID_SWAP;
+			}
 		}
-		offset = idx * SIMPAGESIZE;
+		slots_taken(1);
+		offset = idx * simpagesize;
 	}
 	assert(offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	void *frame_ptr = &physmem[frame * SIMPAGESIZE];
+	void *frame_ptr = &physmem[frame * simpagesize];
 
 	// Seek to position in swap file where this page will be stored
 	off_t pos = lseek(swapfd, offset, SEEK_SET);
@@ -180,11 +432,126 @@ off_t swap_pageout(unsigned int frame, off_t offset)
 		return INVALID_SWAP;
 	}
 
-	// Read page data from swapfile into memory
-	ssize_t bytes_written = write(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_written != SIMPAGESIZE) {
+	// Write page data from memory to swapfile
+	uint64_t start = now_ns();
+	ssize_t bytes_written = write(swapfd, frame_ptr, simpagesize);
+	io_done(&writes, start, bytes_written);
+	if (bytes_written != (ssize_t)simpagesize) {
 		fprintf(stderr, "swap_pageout: did not write whole page\n");
 		return INVALID_SWAP;
 	}
 	return offset;
 }
+
+// Write the pages held in 'frames' to a run of contiguous, newly allocated
+// slots in the swap file using a single vectored write. On success, the
+// slots the pages previously occupied (if any) are released. The swap file
+// is not grown for a batch; when no run is free, the caller writes the pages
+// one at a time into whatever free slots there are.
+// Input:  frames - the physical frame numbers of the pages to write
+//         offsets - the current byte position of each page in the swap file,
+//                   or INVALID_SWAP; replaced with the new positions
+//         n - the number of pages, at most MAX_EVICT_BATCH
+// Return: 0 on success,
+//         -1 if no run of n free slots exists or the write failed, in which
+//         case offsets is left unchanged
+//
+int swap_pageout_batch(const int *frames, off_t *offsets, size_t n)
+{
+	struct iovec iov[n];
+	size_t idx;
+
+	assert(n > 0 && n <= MAX_EVICT_BATCH);
+	if (bitmap_alloc_run(&swapmap, n, &idx) != 0) {
+		return -1;
+	}
+	slots_taken(n);
+	off_t start = idx * simpagesize;
+
+	for (size_t i = 0; i < n; ++i) {
+		iov[i].iov_base = &physmem[frames[i] * simpagesize];
+		iov[i].iov_len = simpagesize;
+	}
+
+	uint64_t t = now_ns();
+	ssize_t bytes_written = pwritev(swapfd, iov, n, start);
+	io_done(&writes, t, bytes_written);
+	if (bytes_written != (ssize_t)(n * simpagesize)) {
+		fprintf(stderr, "swap_pageout_batch: did not write whole batch\n");
+		for (size_t i = 0; i < n; ++i) {
+			swap_free((idx + i) * simpagesize);
+		}
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		if (offsets[i] != INVALID_SWAP) {
+			swap_free(offsets[i]);
+		}
+		offsets[i] = start + i * simpagesize;
+	}
+	return 0;
+}
+
+// Write the swap bitmap and the contents of the swap file to f.
+// Return: 0 on success, -1 on error
+//
+int swap_checkpoint(FILE *f)
+{
+	// Aligned, as the swapfile may be open for direct I/O
+	char buf[1 << 16] __attribute__((aligned(PAGE_SIZE)));
+	off_t len = lseek(swapfd, 0, SEEK_END);
+	int ret = 0;
+
+	if (len < 0) {
+		return -1;
+	}
+	ret |= ckpt_put(f, &slots_used, sizeof(slots_used));
+	ret |= ckpt_put(f, &slots_peak, sizeof(slots_peak));
+	ret |= ckpt_put(f, &swapmap.nbits, sizeof(swapmap.nbits));
+	ret |= ckpt_put(f, swapmap.words, nwords_for_nbits(swapmap.nbits) * sizeof(size_t));
+	ret |= ckpt_put(f, &len, sizeof(len));
+	for (off_t pos = 0; pos < len && ret == 0; ) {
+		ssize_t n = pread(swapfd, buf, sizeof(buf), pos);
+		if (n <= 0) {
+			return -1;
+		}
+		ret |= ckpt_put(f, buf, n);
+		pos += n;
+	}
+	return ret;
+}
+
+// Replace the swap bitmap and the contents of the swap file with what
+// swap_checkpoint() wrote to f.
+// Return: 0 on success, -1 on error
+//
+int swap_restore(FILE *f)
+{
+	char buf[1 << 16] __attribute__((aligned(PAGE_SIZE)));
+	size_t nbits;
+	off_t len;
+
+	if (ckpt_get(f, &slots_used, sizeof(slots_used)) != 0 ||
+	    ckpt_get(f, &slots_peak, sizeof(slots_peak)) != 0 ||
+	    ckpt_get(f, &nbits, sizeof(nbits)) != 0) {
+		return -1;
+	}
+	bitmap_destroy(&swapmap);
+	if (bitmap_init(&swapmap, nbits) != 0 ||
+	    ckpt_get(f, swapmap.words, nwords_for_nbits(nbits) * sizeof(size_t)) != 0 ||
+	    ckpt_get(f, &len, sizeof(len)) != 0) {
+		return -1;
+	}
+	if (ftruncate(swapfd, 0) != 0) {
+		return -1;
+	}
+	for (off_t pos = 0; pos < len; ) {
+		size_t n = len - pos < (off_t)sizeof(buf) ? (size_t)(len - pos) : sizeof(buf);
+		if (ckpt_get(f, buf, n) != 0 || pwrite(swapfd, buf, n, pos) != (ssize_t)n) {
+			return -1;
+		}
+		pos += n;
+	}
+	return 0;
+}
@@ -1,16 +1,27 @@
 #ifndef __SWAP_H__
 #define __SWAP_H__
 
+#include <stdbool.h>
 #include <sys/types.h>
 
 
 // Swap functions for use in other files
 
-void swap_init(size_t size);
+// Smallest frame size that direct (O_DIRECT) swap I/O works with, the
+// logical block size of most devices
+#define SWAP_DIRECT_ALIGN 512
+
+struct swap_io_stats;
+
+void swap_init(size_t size, bool direct);
 void swap_destroy(void);
 
 int swap_pagein(unsigned int frame, off_t offset);
 off_t swap_pageout(unsigned int frame, off_t offset);
+int swap_pageout_batch(const int *frames, off_t *offsets, size_t n);
+void swap_free(off_t offset);
+void swap_usage(size_t *peak, size_t *size);
+void swap_io_stats(struct swap_io_stats *in, struct swap_io_stats *out);
 
 
 #endif /* __SWAP_H__ */
@@ -4,11 +4,12 @@
 #include <time.h>
 
 
-// Returns current time in seconds since the Epoch as a floating point number
+// Returns the CPU time used by the calling thread in seconds as a floating
+// point number. Simulations in batch mode each run in their own thread.
 static inline double get_time()
 {
    struct timespec t;
-   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
    return t.tv_sec + t.tv_nsec / 1000000000.0;
 }
 
@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "trace.h"
+
+//---------------------------------------------------------------------
+// Traces are read through our own buffer with read(2) rather than stdio,
+// so that pipes and stdin work the same way as files and a line can be
+// parsed in place.
+//
+// The compressed container is a header followed by independent blocks:
+//
+//     header: "SIMTRACE", uint32 version, uint32 reserved
+//     block:  uint32 number of references, uint32 payload bytes, payload
+//
+// with all integers little-endian. In the payload each reference is a
+// varint holding (zigzag(vaddr - previous vaddr) << 2 | type) and then the
+// value byte. The previous vaddr starts at 0 in every block. References
+// close to the previous one, the common case, take 2 or 3 bytes instead of
+// the 15 to 20 of a text line, and decoding is a few shifts per reference.
+
+#define TRACE_MAGIC "SIMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_BLOCK_HEADER_SIZE 8
+
+// References per block. Small enough that a live tracer feeding sim through
+// a pipe is not held up for long, large enough that block headers are noise.
+#define TRACE_BLOCK_REFS 4096
+#define TRACE_MAX_RECORD 11   // 10-byte varint and the value
+#define TRACE_MAX_PAYLOAD (TRACE_BLOCK_REFS * TRACE_MAX_RECORD)
+
+#define TRACE_BUFSIZE (1 << 20)
+
+static const char type_chars[4] = { 'I', 'L', 'S', 'M' };
+
+struct trace_reader {
+	int fd;
+	const char *name;
+	bool compressed;
+	char *buf;
+	size_t start;       // first unconsumed byte in buf
+	size_t end;         // end of the data in buf
+	long offset;        // input offset of buf[0]
+	bool eof;
+	size_t linenum;     // lines (or compressed references) consumed
+
+	// Current block of a compressed trace
+	size_t block_refs;  // references left in the block
+	size_t block_end;   // offset in buf just past the block
+	vaddr_t prev;
+};
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return (uint64_t)v << 1 ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int type_code(char type)
+{
+	for (int i = 0; i < 4; i++) {
+		if (type_chars[i] == type) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Reads more input into the buffer, after moving the unconsumed bytes to
+ * the front. Returns the number of bytes read, 0 at end of input, or -1 on
+ * error. */
+static ssize_t refill(struct trace_reader *t)
+{
+	if (t->start > 0) {
+		memmove(t->buf, t->buf + t->start, t->end - t->start);
+		t->offset += t->start;
+		t->end -= t->start;
+		t->start = 0;
+	}
+	if (t->eof || t->end == TRACE_BUFSIZE) {
+		return 0;
+	}
+
+	ssize_t n;
+	do {
+		n = read(t->fd, t->buf + t->end, TRACE_BUFSIZE - t->end);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		perror(t->name);
+		return -1;
+	}
+	if (n == 0) {
+		t->eof = true;
+	}
+	t->end += n;
+	return n;
+}
+
+/* Makes at least n unconsumed bytes available in the buffer.
+ * Returns 0 on success, 1 if the input ends first, -1 on error. */
+static int ensure(struct trace_reader *t, size_t n)
+{
+	while (t->end - t->start < n) {
+		ssize_t got = refill(t);
+		if (got < 0) {
+			return -1;
+		}
+		if (got == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Opens the trace at path, or stdin if path is "-".
+ * Returns NULL (after printing the reason) on error. */
+struct trace_reader *trace_open(const char *path)
+{
+	struct trace_reader *t = calloc(1, sizeof(*t));
+	t->name = path;
+	// Zeroed slack after the buffer stops a corrupt varint from running off
+	// the end of it
+	t->buf = calloc(1, TRACE_BUFSIZE + TRACE_MAX_RECORD);
+	if (strcmp(path, "-") == 0) {
+		t->fd = STDIN_FILENO;
+		t->name = "stdin";
+	} else if ((t->fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		free(t->buf);
+		free(t);
+		return NULL;
+	}
+
+	if (ensure(t, TRACE_HEADER_SIZE) < 0) {
+		trace_close(t);
+		return NULL;
+	}
+	if (t->end - t->start >= TRACE_HEADER_SIZE &&
+	    memcmp(t->buf, TRACE_MAGIC, strlen(TRACE_MAGIC)) == 0) {
+		uint32_t version = get_u32((unsigned char *)t->buf + 8);
+		if (version != TRACE_VERSION) {
+			fprintf(stderr, "%s: unsupported compressed trace version %u\n",
+			        t->name, version);
+			trace_close(t);
+			return NULL;
+		}
+		t->compressed = true;
+		t->start = TRACE_HEADER_SIZE;
+	}
+	return t;
+}
+
+/* Parses one line of a text trace, which has been NUL-terminated.
+ * Returns 1 for a reference, 0 for a line to skip and -1 if the line is
+ * invalid. */
+static int parse_line(struct trace_reader *t, char *line, struct trace_ref *ref)
+{
+	char *p, *end;
+
+	if (line[0] == '=') {
+		return 0;
+	}
+
+	ref->type = line[0];
+	if (ref->type == '\0') {
+		goto invalid;
+	}
+	ref->vaddr = strtoul(line + 1, &p, 16);
+	if (p == line + 1) {
+		goto invalid;
+	}
+	ref->val = strtoul(p, &end, 10);
+	if (end == p) {
+		goto invalid;
+	}
+
+	if (type_code(ref->type) < 0) {
+		fprintf(stderr,"%s: invalid reftype, line %zu: %s\n",
+			t->name, t->linenum, line);
+		return -1;
+	}
+	if ((ref->vaddr % PAGE_SIZE) > simpagesize) {
+		fprintf(stderr,"%s: invalid vaddr, offset must be in range of simulated page frame size, line %zu: %s\n",
+			t->name, t->linenum, line);
+		return -1;
+	}
+	return 1;
+
+invalid:
+	fprintf(stderr, "%s: invalid trace line %zu: %s\n",
+		t->name, t->linenum, line);
+	return -1;
+}
+
+static int next_text(struct trace_reader *t, struct trace_ref *ref)
+{
+	for (;;) {
+		char *line = t->buf + t->start;
+		char *nl = memchr(line, '\n', t->end - t->start);
+		if (!nl) {
+			ssize_t got = refill(t);
+			if (got < 0) {
+				return -1;
+			}
+			if (got > 0) {
+				continue;
+			}
+			if (t->start == t->end) {
+				return 0;
+			}
+			if (t->end == TRACE_BUFSIZE) {
+				fprintf(stderr, "%s: line %zu is too long\n", t->name, t->linenum + 1);
+				return -1;
+			}
+			// Last line without a newline
+			line = t->buf + t->start;
+			nl = t->buf + t->end;
+		}
+		*nl = '\0';
+		t->start = nl - t->buf + 1;
+		if (t->start > t->end) {
+			t->start = t->end;
+		}
+		t->linenum += 1;
+
+		int ret = parse_line(t, line, ref);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+}
+
+static int next_compressed(struct trace_reader *t, struct trace_ref *ref)
+{
+	if (t->block_refs == 0) {
+		int ret = ensure(t, TRACE_BLOCK_HEADER_SIZE);
+		if (ret != 0) {
+			if (ret > 0 && t->start != t->end) {
+				fprintf(stderr, "%s: truncated block header\n", t->name);
+				return -1;
+			}
+			return ret < 0 ? -1 : 0;
+		}
+		unsigned char *hdr = (unsigned char *)t->buf + t->start;
+		uint32_t nrefs = get_u32(hdr);
+		uint32_t nbytes = get_u32(hdr + 4);
+		if (nrefs == 0 || nrefs > TRACE_BLOCK_REFS || nbytes > TRACE_MAX_PAYLOAD) {
+			fprintf(stderr, "%s: corrupt block after reference %zu\n",
+			        t->name, t->linenum);
+			return -1;
+		}
+		// The whole block is in the buffer from here on, so decoding
+		// needs no further bounds checks against the input
+		if (ensure(t, TRACE_BLOCK_HEADER_SIZE + nbytes) != 0) {
+			fprintf(stderr, "%s: truncated block after reference %zu\n",
+			        t->name, t->linenum);
+			return -1;
+		}
+		t->start += TRACE_BLOCK_HEADER_SIZE;
+		t->block_refs = nrefs;
+		t->block_end = t->start + nbytes;
+		t->prev = 0;
+	}
+
+	const unsigned char *p = (unsigned char *)t->buf + t->start;
+	uint64_t v = 0;
+	int shift = 0;
+	while ((*p & 0x80) && shift < 63) {
+		v |= (uint64_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	v |= (uint64_t)*p++ << shift;
+
+	ref->type = type_chars[v & 3];
+	ref->vaddr = t->prev + unzigzag(v >> 2);
+	ref->val = *p++;
+	t->prev = ref->vaddr;
+
+	t->start = p - (unsigned char *)t->buf;
+	t->block_refs -= 1;
+	t->linenum += 1;
+	if ((t->block_refs == 0 && t->start != t->block_end) || t->start > t->block_end) {
+		fprintf(stderr, "%s: corrupt block before reference %zu\n",
+		        t->name, t->linenum);
+		return -1;
+	}
+	if ((ref->vaddr % PAGE_SIZE) > simpagesize) {
+		fprintf(stderr, "%s: invalid vaddr, offset must be in range of simulated page frame size, reference %zu\n",
+		        t->name, t->linenum);
+		return -1;
+	}
+	return 1;
+}
+
+/* Reads the next reference from the trace into ref.
+ * Returns 1 if there was one, 0 at the end of the trace and -1 on an
+ * invalid or unreadable trace (after printing the reason). */
+int trace_next(struct trace_reader *t, struct trace_ref *ref)
+{
+	return t->compressed ? next_compressed(t, ref) : next_text(t, ref);
+}
+
+/* Returns the number of lines (for a compressed trace, references) read. */
+size_t trace_linenum(const struct trace_reader *t)
+{
+	return t->linenum;
+}
+
+/* Returns the number of bytes read from the input but not consumed yet.
+ * When it is 0, the next call to trace_next() reads from the input. */
+size_t trace_buffered(const struct trace_reader *t)
+{
+	return t->end - t->start;
+}
+
+/* Returns the input offset of the next text line, or -1 for a compressed
+ * trace, which can only be resumed by skipping references. */
+long trace_tell(const struct trace_reader *t)
+{
+	return t->compressed ? -1 : t->offset + (long)t->start;
+}
+
+/* Continues a freshly opened trace from the point where trace_tell() and
+ * trace_linenum() were taken. Seeks there if the input allows it, and
+ * otherwise reads and drops everything before it.
+ * Returns 0 on success and -1 if the trace ends first or cannot be read. */
+int trace_resume(struct trace_reader *t, long pos, size_t linenum)
+{
+	if (!t->compressed && pos >= 0 && lseek(t->fd, pos, SEEK_SET) == pos) {
+		t->start = t->end = 0;
+		t->offset = pos;
+		t->eof = false;
+		t->linenum = linenum;
+		return 0;
+	}
+
+	struct trace_ref ref;
+	while (t->linenum < linenum) {
+		if (trace_next(t, &ref) != 1) {
+			return -1;
+		}
+	}
+	return t->linenum == linenum ? 0 : -1;
+}
+
+void trace_close(struct trace_reader *t)
+{
+	if (t->fd != STDIN_FILENO) {
+		close(t->fd);
+	}
+	free(t->buf);
+	free(t);
+}
+
+//---------------------------------------------------------------------
+// Writing compressed traces.
+
+struct trace_writer {
+	int fd;
+	unsigned char *buf;  // block header and payload being built
+	size_t len;
+	uint32_t nrefs;
+	vaddr_t prev;
+};
+
+static int write_all(int fd, const void *p, size_t n)
+{
+	const char *c = p;
+	while (n > 0) {
+		ssize_t w = write(fd, c, n);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return -1;
+		}
+		c += w;
+		n -= w;
+	}
+	return 0;
+}
+
+/* Starts a compressed trace on fd and writes its header.
+ * Returns NULL on a write error. */
+struct trace_writer *trace_create(int fd)
+{
+	unsigned char header[TRACE_HEADER_SIZE] = { 0 };
+	memcpy(header, TRACE_MAGIC, strlen(TRACE_MAGIC));
+	put_u32(header + 8, TRACE_VERSION);
+	if (write_all(fd, header, sizeof(header)) != 0) {
+		return NULL;
+	}
+
+	struct trace_writer *w = calloc(1, sizeof(*w));
+	w->fd = fd;
+	w->buf = malloc(TRACE_BLOCK_HEADER_SIZE + TRACE_MAX_PAYLOAD);
+	w->len = TRACE_BLOCK_HEADER_SIZE;
+	return w;
+}
+
+/* Writes out the references added since the last block, so that a reader
+ * on the other end of a pipe sees them now. Returns 0 on success and -1 on
+ * a write error. */
+int trace_flush(struct trace_writer *w)
+{
+	if (w->nrefs == 0) {
+		return 0;
+	}
+	put_u32(w->buf, w->nrefs);
+	put_u32(w->buf + 4, w->len - TRACE_BLOCK_HEADER_SIZE);
+	int ret = write_all(w->fd, w->buf, w->len);
+	w->len = TRACE_BLOCK_HEADER_SIZE;
+	w->nrefs = 0;
+	w->prev = 0;
+	return ret;
+}
+
+/* Adds a reference to the trace. Returns 0 on success and -1 on a write
+ * error or an invalid reference type. */
+int trace_write(struct trace_writer *w, const struct trace_ref *ref)
+{
+	int code = type_code(ref->type);
+	if (code < 0) {
+		return -1;
+	}
+
+	uint64_t zz = zigzag(ref->vaddr - w->prev);
+	if (zz >> 62) {
+		// A jump this large does not fit next to the type; start a new
+		// block so that the delta is from 0
+		if (trace_flush(w) != 0) {
+			return -1;
+		}
+		zz = zigzag(ref->vaddr);
+		if (zz >> 62) {
+			return -1;
+		}
+	}
+	uint64_t v = zz << 2 | code;
+
+	unsigned char *p = w->buf + w->len;
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	*p++ = ref->val;
+	w->len = p - w->buf;
+	w->prev = ref->vaddr;
+
+	if (++w->nrefs == TRACE_BLOCK_REFS) {
+		return trace_flush(w);
+	}
+	return 0;
+}
+
+/* Writes out the last block and frees the writer. The file descriptor is
+ * left open. Returns 0 on success and -1 on a write error. */
+int trace_finish(struct trace_writer *w)
+{
+	int ret = trace_flush(w);
+	free(w->buf);
+	free(w);
+	return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "pagetable_generic.h"
+
+
+// Reading and writing reference traces. A trace is either text, one
+// "type vaddr value" reference per line, or the block-compressed container
+// that tracepack writes. Either can come from a regular file, a pipe or
+// stdin ("-"); the format is detected from the first bytes.
+
+struct trace_ref {
+	char type;          // I, L, S or M
+	vaddr_t vaddr;
+	unsigned char val;
+};
+
+struct trace_reader;
+struct trace_writer;
+
+struct trace_reader *trace_open(const char *path);
+int trace_next(struct trace_reader *t, struct trace_ref *ref);
+size_t trace_linenum(const struct trace_reader *t);
+size_t trace_buffered(const struct trace_reader *t);
+long trace_tell(const struct trace_reader *t);
+int trace_resume(struct trace_reader *t, long pos, size_t linenum);
+void trace_close(struct trace_reader *t);
+
+struct trace_writer *trace_create(int fd);
+int trace_write(struct trace_writer *w, const struct trace_ref *ref);
+int trace_flush(struct trace_writer *w);
+int trace_finish(struct trace_writer *w);
+
+
+#endif /* __TRACE_H__ */
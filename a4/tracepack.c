@@ -0,0 +1,98 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "trace.h"
+
+// tracepack converts a trace to the compressed container that sim reads
+// (see trace.c), or with -d back to text. Input and output default to stdin
+// and stdout, so a tracer can feed sim live:
+//
+//     tracer | ./tracepack | ./sim -f - -m 100 -a lru
+//
+// With -F each block is written as soon as it is full and the rest is
+// flushed whenever the input pauses, instead of only at the end.
+
+// Offsets are checked against the largest frame size sim can be run with;
+// the frame size of a particular run is checked when sim reads the trace.
+size_t simpagesize = MAX_SIMPAGESIZE;
+
+int main(int argc, char *argv[])
+{
+	const char *usage = "USAGE: tracepack [-d] [-F] [input|- [output]]\n";
+	bool decode = false;
+	bool live = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "dF")) != -1) {
+		switch (opt) {
+		case 'd':
+			decode = true;
+			break;
+		case 'F':
+			live = true;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return 1;
+		}
+	}
+	if (argc - optind > 2) {
+		fprintf(stderr, "%s", usage);
+		return 1;
+	}
+
+	const char *in = optind < argc ? argv[optind] : "-";
+	struct trace_reader *t = trace_open(in);
+	if (!t) {
+		return 1;
+	}
+
+	int fd = STDOUT_FILENO;
+	if (optind + 1 < argc &&
+	    (fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(argv[optind + 1]);
+		trace_close(t);
+		return 1;
+	}
+
+	struct trace_ref ref;
+	int ret;
+	if (decode) {
+		FILE *out = fdopen(fd, "w");
+		while ((ret = trace_next(t, &ref)) > 0) {
+			fprintf(out, "%c %lx %hhu\n", ref.type, ref.vaddr, ref.val);
+		}
+		if (fclose(out) != 0) {
+			perror("tracepack");
+			ret = -1;
+		}
+	} else {
+		struct trace_writer *w = trace_create(fd);
+		if (!w) {
+			perror("tracepack");
+			trace_close(t);
+			return 1;
+		}
+		while ((ret = trace_next(t, &ref)) > 0) {
+			if (trace_write(w, &ref) != 0 ||
+			    (live && trace_buffered(t) == 0 && trace_flush(w) != 0)) {
+				perror("tracepack");
+				ret = -1;
+				break;
+			}
+		}
+		if (trace_finish(w) != 0) {
+			perror("tracepack");
+			ret = -1;
+		}
+		close(fd);
+	}
+
+	trace_close(t);
+	return ret < 0 ? 1 : 0;
+}
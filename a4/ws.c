@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include "pagetable_generic.h"
+#include "checkpoint.h"
+
+__thread size_t ws_tau;
+
+// Resident frames ordered by last use, most recent first. Uses the list
+// fields of the coremap entries.
+static __thread struct frame ws_head;
+
+//---------------------------------------------------------------------
+// Working set size over time. We keep a fixed number of samples; when they
+// run out, adjacent samples are merged and the sampling interval doubles.
+
+#define WS_SAMPLES 64
+
+struct ws_sample {
+	size_t wss;     // resident pages referenced in the last tau references
+	size_t faults;  // misses during the interval
+};
+
+static __thread struct ws_sample ws_samples[WS_SAMPLES];
+static __thread size_t ws_nsamples;
+static __thread size_t ws_interval;
+static __thread size_t ws_next_sample;
+static __thread size_t ws_last_misses;
+static __thread size_t ws_wss_max;
+
+static size_t ws_size(void)
+{
+	size_t wss = 0;
+	for (size_t i = 0; i < memsize; i++) {
+		if (coremap[i].in_use && ref_count - frame_last_use[i] < ws_tau) {
+			wss += 1;
+		}
+	}
+	return wss;
+}
+
+void ws_stats_init(void)
+{
+	ws_nsamples = 0;
+	ws_interval = ws_tau;
+	ws_next_sample = ws_interval;
+	ws_last_misses = 0;
+	ws_wss_max = 0;
+}
+
+void ws_tick(void)
+{
+	if (ref_count < ws_next_sample) {
+		return;
+	}
+	ws_next_sample += ws_interval;
+
+	if (ws_nsamples == WS_SAMPLES) {
+		for (size_t i = 0; i < WS_SAMPLES / 2; i++) {
+			ws_samples[i].wss = (ws_samples[2 * i].wss + ws_samples[2 * i + 1].wss) / 2;
+			ws_samples[i].faults = ws_samples[2 * i].faults + ws_samples[2 * i + 1].faults;
+		}
+		ws_nsamples = WS_SAMPLES / 2;
+		ws_interval *= 2;
+		// The pending sample is only half way through its new interval
+		ws_next_sample = ref_count + ws_interval / 2;
+		return;
+	}
+
+	struct ws_sample *s = &ws_samples[ws_nsamples++];
+	s->wss = ws_size();
+	s->faults = miss_count - ws_last_misses;
+	ws_last_misses = miss_count;
+	if (s->wss > ws_wss_max) {
+		ws_wss_max = s->wss;
+	}
+}
+
+/* Prints the working set size and page fault frequency over time. */
+void ws_report(void)
+{
+	size_t total = 0;
+
+	printf("\nWorking set size over time (tau = %zu references):\n", ws_tau);
+	printf("  %12s %8s %8s %10s\n", "references", "wss", "faults", "faults/ref");
+	for (size_t i = 0; i < ws_nsamples; i++) {
+		printf("  %12zu %8zu %8zu %10.4f\n", (i + 1) * ws_interval,
+		       ws_samples[i].wss, ws_samples[i].faults,
+		       (double)ws_samples[i].faults / ws_interval);
+		total += ws_samples[i].wss;
+	}
+	if (ws_nsamples > 0) {
+		printf("  average wss %.1f, max %zu\n",
+		       (double)total / ws_nsamples, ws_wss_max);
+	}
+}
+
+//---------------------------------------------------------------------
+// Exact working set (WS) algorithm. A page leaves memory as soon as it has
+// not been referenced for tau references, so the resident set tracks the
+// working set. If the working set does not fit in memory, the least
+// recently used page is evicted.
+
+/* Page to evict is the least recently used resident page.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int ws_evict(void)
+{
+	struct frame *victim = ws_head.prev;
+	assert(victim != &ws_head);
+	frame_list_delete(victim);
+	return victim->frame;
+}
+
+/* Takes up to n victims, least recently used first.
+ * Returns the number of victims stored in frames.
+ */
+size_t ws_evict_batch(int *frames, size_t n)
+{
+	size_t count = 0;
+	while (count < n && ws_head.prev != &ws_head) {
+		frames[count++] = ws_evict();
+	}
+	return count;
+}
+
+/* This function is called on each access to a page. Moves the page to the
+ * front of the list and releases the frames of pages that have dropped out
+ * of the working set.
+ */
+void ws_ref(int frame)
+{
+	struct frame *f = &coremap[frame];
+
+	if (f->next != NULL) {
+		frame_list_delete(f);
+	}
+	frame_list_insert(f, &ws_head, ws_head.next);
+
+	while (ws_head.prev != f &&
+	       ref_count - frame_last_use[ws_head.prev->frame] >= ws_tau) {
+		struct frame *old = ws_head.prev;
+		frame_list_delete(old);
+		release_frame(old->frame);
+	}
+	ws_tick();
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void ws_init(void)
+{
+	frame_list_init_head(&ws_head);
+	ws_stats_init();
+}
+
+/* Cleanup any data structures created in ws_init(). */
+void ws_cleanup(void)
+{
+}
+
+/* Save the working set samples to a checkpoint. */
+int ws_stats_checkpoint(FILE *f)
+{
+	return ckpt_put(f, ws_samples, sizeof(ws_samples)) |
+	       ckpt_put(f, &ws_nsamples, sizeof(ws_nsamples)) |
+	       ckpt_put(f, &ws_interval, sizeof(ws_interval)) |
+	       ckpt_put(f, &ws_next_sample, sizeof(ws_next_sample)) |
+	       ckpt_put(f, &ws_last_misses, sizeof(ws_last_misses)) |
+	       ckpt_put(f, &ws_wss_max, sizeof(ws_wss_max));
+}
+
+/* Restore the samples saved by ws_stats_checkpoint(). */
+int ws_stats_restore(FILE *f)
+{
+	if (ckpt_get(f, ws_samples, sizeof(ws_samples)) != 0 ||
+	    ckpt_get(f, &ws_nsamples, sizeof(ws_nsamples)) != 0 ||
+	    ckpt_get(f, &ws_interval, sizeof(ws_interval)) != 0 ||
+	    ckpt_get(f, &ws_next_sample, sizeof(ws_next_sample)) != 0 ||
+	    ckpt_get(f, &ws_last_misses, sizeof(ws_last_misses)) != 0 ||
+	    ckpt_get(f, &ws_wss_max, sizeof(ws_wss_max)) != 0 ||
+	    ws_nsamples > WS_SAMPLES) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Save the recency list, as frame numbers from most to least recently used,
+ * and the working set samples to a checkpoint. */
+int ws_checkpoint(FILE *f)
+{
+	size_t n = 0;
+	int ret = 0;
+
+	for (struct frame *p = ws_head.next; p != &ws_head; p = p->next) {
+		n++;
+	}
+	ret |= ckpt_put(f, &n, sizeof(n));
+	for (struct frame *p = ws_head.next; p != &ws_head; p = p->next) {
+		ret |= ckpt_put(f, &p->frame, sizeof(p->frame));
+	}
+	return ret | ws_stats_checkpoint(f);
+}
+
+/* Restore the state saved by ws_checkpoint(). */
+int ws_restore(FILE *f)
+{
+	size_t n;
+
+	if (ckpt_get(f, &n, sizeof(n)) != 0 || n > memsize) {
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		int frame;
+		if (ckpt_get(f, &frame, sizeof(frame)) != 0 ||
+		    frame < 0 || (size_t)frame >= memsize) {
+			return -1;
+		}
+		frame_list_insert(&coremap[frame], ws_head.prev, &ws_head);
+	}
+	return ws_stats_restore(f);
+}